@@ -0,0 +1,50 @@
+#include "pch.h"
+
+#include "arena.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+
+search_arena::upstream::upstream(std::pmr::memory_resource* buffer) :
+    _buffer(buffer)
+{
+}
+
+void* search_arena::upstream::do_allocate(const std::size_t bytes,
+    const std::size_t alignment)
+{
+    return bytes > large_block ?
+        std::pmr::new_delete_resource()->allocate(bytes, alignment) :
+        _buffer->allocate(bytes, alignment);
+}
+
+void search_arena::upstream::do_deallocate(void* ptr,
+    const std::size_t bytes, const std::size_t alignment)
+{
+    // The buffer only frees on release()
+    if (bytes > large_block)
+        std::pmr::new_delete_resource()->deallocate(ptr, bytes, alignment);
+}
+
+bool search_arena::upstream::do_is_equal
+    (const std::pmr::memory_resource& rhs) const noexcept
+{
+    return this == &rhs;
+}
+
+search_arena::search_arena() :
+    _initial(std::make_unique_for_overwrite<std::byte[]>(initial_size)),
+    _buffer(_initial.get(), initial_size),
+    _upstream(&_buffer),
+    // Larger blocks bypass the pools and go straight to _upstream
+    _pool(std::pmr::pool_options{ 0, large_block }, &_upstream)
+{
+}
+
+void search_arena::reset()
+{
+    // Files that outgrew the initial buffer free the overflow here
+    _pool.release();
+    _buffer.release();
+}
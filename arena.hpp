@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+
+// Per thread memory for the containers in match_data.
+// Blocks freed while a file is being searched are recycled by the pool and
+// everything is handed back to a buffer allocated once per thread when the
+// next file starts, so searching does not normally touch the heap.
+// The exception is grammar stages, as parsertl allocates its own parse
+// stacks and productions.
+// The buffer never frees anything before then, so blocks too large for the
+// pool (such as a big edit log or action result) come from the heap
+// instead and go straight back to it when freed.
+class search_arena
+{
+public:
+    search_arena();
+    search_arena(const search_arena&) = delete;
+    search_arena& operator=(const search_arena&) = delete;
+
+    std::pmr::memory_resource* resource()
+    {
+        return &_pool;
+    }
+
+    // Only call once nothing allocated from resource() is in use.
+    void reset();
+
+private:
+    // Sends large blocks to the heap and the rest to the buffer
+    class upstream : public std::pmr::memory_resource
+    {
+    public:
+        explicit upstream(std::pmr::memory_resource* buffer);
+
+    private:
+        std::pmr::memory_resource* _buffer = nullptr;
+
+        void* do_allocate(const std::size_t bytes,
+            const std::size_t alignment) override;
+        void do_deallocate(void* ptr, const std::size_t bytes,
+            const std::size_t alignment) override;
+        bool do_is_equal(const std::pmr::memory_resource& rhs)
+            const noexcept override;
+    };
+
+    static constexpr std::size_t initial_size = 256 * 1024;
+    static constexpr std::size_t large_block = 64 * 1024;
+
+    std::unique_ptr<std::byte[]> _initial;
+    std::pmr::monotonic_buffer_resource _buffer;
+    upstream _upstream;
+    std::pmr::unsynchronized_pool_resource _pool;
+};
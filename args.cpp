@@ -8,7 +8,6 @@
 #include <parsertl/enums.hpp>
 #include <lexertl/iterator.hpp>
 #include <parsertl/iterator.hpp>
-#include <boost/regex.hpp>
 
 #include <cctype>
 #include <charconv>
@@ -57,15 +56,6 @@ std::vector<std::string_view> split(const char* str, const char c)
     return ret;
 }
 
-bool is_windows()
-{
-#ifdef _WIN32
-    return true;
-#else
-    return false;
-#endif
-}
-
 void parse_condition(const char* str)
 {
     if (g_condition_parser._gsm.empty())
@@ -83,8 +73,9 @@ void parse_condition(const char* str)
             const auto index = giter.dollar(2);
             const auto rx = giter.dollar(4);
 
-            g_options._conditions[atoi(index.first + 1) & 0xffff] =
-                boost::regex(dedup_apostrophes(rx.substr(1, 1)));
+            g_options._conditions.insert_or_assign(
+                static_cast<uint16_t>(atoi(index.first + 1) & 0xffff),
+                condition(dedup_apostrophes(rx.substr(1, 1))));
         }
     }
 
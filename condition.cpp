@@ -0,0 +1,73 @@
+#include "pch.h"
+
+#include "condition.hpp"
+#include "posix_regex.hpp"
+
+#include <lexertl/generator.hpp>
+#include <lexertl/iterator.hpp>
+#include <lexertl/rules.hpp>
+
+#include <cstddef>
+#include <exception>
+#include <string>
+
+// Shorter spans are searched again rather than looked up
+static constexpr std::size_t g_min_cached = 64;
+
+condition::condition(const std::string& regex) :
+    _rx(regex)
+{
+    if (std::string dfa_rx; ecmascript_to_lexertl(regex, dfa_rx))
+    {
+        try
+        {
+            lexertl::rules rules;
+
+            rules.push(dfa_rx, 1);
+            rules.push("(?s:.)", lexertl::rules::skip());
+            lexertl::generator::build(rules, _sm);
+            _scanner = start_scanner(_sm, false);
+        }
+        catch (const std::exception&)
+        {
+            // Fall back to boost
+            _sm.clear();
+        }
+    }
+}
+
+bool condition::search(const char* first, const char* second) const
+{
+    if (_sm.empty())
+    {
+        // Reused, as boost allocates the sub-matches otherwise
+        static thread_local boost::cmatch what;
+
+        return boost::regex_search(first, second, what, _rx,
+            boost::regex_constants::match_any);
+    }
+
+    lexertl::criterator iter(_scanner.find(first, second), second, _sm);
+
+    return iter->id == 1;
+}
+
+bool condition_cache::search(const condition& cond, const char* first,
+    const char* second)
+{
+    // Text produced by grammar actions can reuse the addresses of earlier
+    // text, so only spans of the buffer itself are cached.
+    if (static_cast<std::size_t>(second - first) < g_min_cached ||
+        first < _first || second > _second)
+    {
+        return cond.search(first, second);
+    }
+
+    const auto [iter, inserted] =
+        _outcomes.try_emplace(key{ &cond, first, second }, false);
+
+    if (inserted)
+        iter->second = cond.search(first, second);
+
+    return iter->second;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "scan.hpp"
+
+#include <boost/regex.hpp>
+#include <lexertl/state_machine.hpp>
+
+#include <cstddef>
+#include <functional>
+#include <memory_resource>
+#include <string>
+#include <unordered_map>
+
+// A regex_search($n, 'regex') condition (--if).
+// A condition only asks whether the regex matches anywhere, so if the
+// regex can be expressed as a DFA it is searched for with that instead
+// of boost (which finds a different match, but not a different answer).
+struct condition
+{
+    boost::regex _rx;
+    // Empty if the regex is left to boost
+    lexertl::state_machine _sm;
+    byte_scanner _scanner;
+
+    explicit condition(const std::string& regex);
+
+    bool search(const char* first, const char* second) const;
+};
+
+// The outcome of each condition for the capture spans already checked
+// in the current buffer. A grammar search that fails a condition
+// restarts at the next token and will often capture the same text again.
+class condition_cache
+{
+public:
+    explicit condition_cache(std::pmr::memory_resource* resource) :
+        _outcomes(resource)
+    {
+    }
+
+    // Call whenever the buffer [first, second) changes.
+    void reset(const char* first, const char* second)
+    {
+        _first = first;
+        _second = second;
+        _outcomes.clear();
+    }
+
+    bool search(const condition& cond, const char* first,
+        const char* second);
+
+private:
+    struct key
+    {
+        const condition* _cond = nullptr;
+        const char* _first = nullptr;
+        const char* _second = nullptr;
+
+        bool operator==(const key& rhs) const = default;
+    };
+
+    struct key_hash
+    {
+        std::size_t operator()(const key& k) const
+        {
+            std::size_t hash = std::hash<const void*>()(k._cond);
+
+            hash = hash * 31 + std::hash<const void*>()(k._first);
+            return hash * 31 + std::hash<const void*>()(k._second);
+        }
+    };
+
+    const char* _first = nullptr;
+    const char* _second = nullptr;
+    std::pmr::unordered_map<key, bool, key_hash> _outcomes;
+};
@@ -0,0 +1,150 @@
+#include "pch.h"
+
+#include "config_cache.hpp"
+#include "types.hpp"
+#include "version.hpp"
+
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <lexertl/serialise.hpp>
+#include <parsertl/serialise.hpp>
+#include <lexertl/state_machine.hpp>
+#include <parsertl/state_machine.hpp>
+#include <boost/serialization/string.hpp>
+
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <ios>
+#include <random>
+#include <string>
+#include <system_error>
+
+extern options g_options;
+
+namespace fs = std::filesystem;
+
+// Bump when the layout of a cache entry changes
+static constexpr uint16_t g_cache_format = 1;
+
+static uint64_t fnv1a(uint64_t hash, const char* first, const char* second)
+{
+    for (; first != second; ++first)
+    {
+        hash ^= static_cast<unsigned char>(*first);
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+config_cache::config_cache(const std::string& cache_dir, const char* first,
+    const char* second, const unsigned int flags)
+{
+    const uint16_t version[] = { g_version };
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    _key = std::format("gram_grep {}.{}.{}.{} cache {} flags {} utf8 {} "
+        "dump {} size {}",
+        version[0], version[1], version[2], version[3],
+        g_cache_format,
+        flags,
+        g_options._force_unicode,
+        static_cast<int>(g_options._dump),
+        second - first);
+    hash = fnv1a(hash, _key.c_str(), _key.c_str() + _key.size());
+    hash = fnv1a(hash, first, second);
+    _pathname = (fs::path(cache_dir) / std::format("{:016x}.ggc", hash)).
+        string();
+}
+
+template<typename lsm_type>
+bool config_cache::load(parsertl::state_machine& gsm, lsm_type& lsm,
+    std::string& warnings) const
+{
+    std::ifstream is(_pathname, std::ios::binary);
+
+    if (!is)
+        return false;
+
+    try
+    {
+        boost::archive::binary_iarchive ia(is);
+        std::string key;
+
+        ia & key;
+
+        // Guards against hash collisions as well as stale formats
+        if (key != _key)
+            return false;
+
+        ia & warnings;
+        parsertl::serialise(gsm, ia);
+        lexertl::serialise(lsm, ia);
+    }
+    catch (const std::exception&)
+    {
+        // Truncated or corrupt, so rebuild
+        gsm.clear();
+        lsm.clear();
+        warnings.clear();
+        return false;
+    }
+
+    return true;
+}
+
+template<typename lsm_type>
+void config_cache::save(parsertl::state_machine& gsm, lsm_type& lsm,
+    const std::string& warnings) const
+{
+    std::error_code ec;
+    const fs::path pathname(_pathname);
+    // Unique name so that concurrent runs never see a partial entry
+    const fs::path temp = pathname.string() +
+        std::format(".{:08x}.tmp", std::random_device()());
+
+    fs::create_directories(pathname.parent_path(), ec);
+
+    try
+    {
+        std::ofstream os(temp, std::ios::binary);
+
+        if (!os)
+            return;
+
+        {
+            boost::archive::binary_oarchive oa(os);
+
+            oa & _key;
+            oa & warnings;
+            parsertl::serialise(gsm, oa);
+            lexertl::serialise(lsm, oa);
+        }
+
+        os.close();
+
+        if (!os)
+            throw std::ios_base::failure("write failed");
+
+        fs::rename(temp, pathname, ec);
+    }
+    catch (const std::exception&)
+    {
+        ec = std::make_error_code(std::errc::io_error);
+    }
+
+    if (ec)
+        fs::remove(temp, ec);
+}
+
+template bool config_cache::load(parsertl::state_machine& gsm,
+    lexertl::state_machine& lsm, std::string& warnings) const;
+template bool config_cache::load(parsertl::state_machine& gsm,
+    lexertl::u32state_machine& lsm, std::string& warnings) const;
+template void config_cache::save(parsertl::state_machine& gsm,
+    lexertl::state_machine& lsm, const std::string& warnings) const;
+template void config_cache::save(parsertl::state_machine& gsm,
+    lexertl::u32state_machine& lsm, const std::string& warnings) const;
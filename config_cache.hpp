@@ -0,0 +1,30 @@
+#pragma once
+
+#include <lexertl/state_machine.hpp>
+#include <parsertl/state_machine.hpp>
+
+#include <cstddef>
+#include <string>
+
+// On disk cache of the state machines built from a config file.
+// Entries are keyed by a hash of the config file contents plus
+// everything else that affects the build (flags, --utf8, --dump and
+// the gram_grep version).
+struct config_cache
+{
+    std::string _pathname;
+    std::string _key;
+
+    config_cache(const std::string& cache_dir, const char* first,
+        const char* second, const unsigned int flags);
+
+    // Returns false (leaving the state machines empty) on a miss
+    // or if the entry is unreadable.
+    template<typename lsm_type>
+    bool load(parsertl::state_machine& gsm, lsm_type& lsm,
+        std::string& warnings) const;
+    // Best effort; failing to write the cache is not an error.
+    template<typename lsm_type>
+    void save(parsertl::state_machine& gsm, lsm_type& lsm,
+        const std::string& warnings) const;
+};
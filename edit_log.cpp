@@ -0,0 +1,90 @@
+#include "pch.h"
+
+#include "edit_log.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory_resource>
+#include <string_view>
+
+edit_log::edit_log(std::pmr::memory_resource* resource) :
+    _edits(resource),
+    _text(resource)
+{
+}
+
+void edit_log::add(const std::size_t offset, const std::size_t size,
+    const std::string_view text)
+{
+    _edits.push_back({ offset, size, _text.size(), text.size(), _batch });
+    _text += text;
+}
+
+void edit_log::splice(edit_log& rhs)
+{
+    const std::size_t base = _text.size();
+
+    _text += rhs._text;
+    ++_batch;
+
+    for (edit e : rhs._edits)
+    {
+        e._text_offset += base;
+        e._batch = _batch;
+        e._spliced = true;
+        _edits.push_back(e);
+    }
+
+    rhs.clear();
+}
+
+void edit_log::clear()
+{
+    _edits.clear();
+    _text.clear();
+    _batch = 0;
+}
+
+std::size_t edit_log::sort()
+{
+    std::size_t conflicts = 0;
+    auto out = _edits.begin();
+
+    // Stable, so that edits of the same span stay in the order made
+    std::ranges::stable_sort(_edits, [](const edit& lhs, const edit& rhs)
+        {
+            return lhs._offset < rhs._offset ||
+                (lhs._offset == rhs._offset && lhs._size < rhs._size);
+        });
+
+    for (auto iter = _edits.begin(), end = _edits.end(); iter != end; ++iter)
+    {
+        if (out != _edits.begin())
+        {
+            const edit& prev = *(out - 1);
+
+            if (iter->_offset == prev._offset && iter->_size == prev._size)
+            {
+                // Same span, so replace the earlier edit unless a later
+                // search is editing it again (the first search wins).
+                if (!iter->_spliced || iter->_batch == prev._batch)
+                    *(out - 1) = *iter;
+
+                continue;
+            }
+
+            // An insertion sorts before a span starting at the same
+            // offset, so only edits starting inside a span conflict.
+            if (iter->_offset < prev._offset + prev._size)
+            {
+                ++conflicts;
+                continue;
+            }
+        }
+
+        *out++ = *iter;
+    }
+
+    _edits.erase(out, _edits.end());
+    return conflicts;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The replacements to make to one file.
+// Edits are appended as they are found, with their text packed into a
+// single buffer, and only sorted (once) when the file is written.
+class edit_log
+{
+public:
+    struct edit
+    {
+        std::size_t _offset = 0;
+        // Bytes replaced (0 for an insertion)
+        std::size_t _size = 0;
+        // Location of the replacement text in the buffer
+        std::size_t _text_offset = 0;
+        std::size_t _text_size = 0;
+        // The splice that brought the edit in
+        std::size_t _batch = 0;
+        bool _spliced = false;
+    };
+
+    explicit edit_log(std::pmr::memory_resource* resource);
+
+    bool empty() const
+    {
+        return _edits.empty();
+    }
+
+    const std::pmr::vector<edit>& edits() const
+    {
+        return _edits;
+    }
+
+    std::string_view text(const edit& e) const
+    {
+        return std::string_view(_text).substr(e._text_offset, e._text_size);
+    }
+
+    void add(const std::size_t offset, const std::size_t size,
+        const std::string_view text);
+    // Moves the edits of rhs to the end of this log as a new batch.
+    void splice(edit_log& rhs);
+    void clear();
+    // Orders the edits by position. Where the same span is edited more
+    // than once the last edit wins, except that a spliced edit does not
+    // replace one from an earlier batch. Edits overlapping an earlier one
+    // are dropped. Returns the number of edits dropped for overlapping.
+    std::size_t sort();
+
+private:
+    std::pmr::vector<edit> _edits;
+    std::pmr::string _text;
+    std::size_t _batch = 0;
+};
@@ -0,0 +1,205 @@
+#include "pch.h"
+
+#include "glob_set.hpp"
+
+#include <lexertl/enums.hpp>
+#include <lexertl/generator.hpp>
+#include <lexertl/lookup.hpp>
+#include <lexertl/match_results.hpp>
+#include <lexertl/rules.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <string>
+#include <string_view>
+
+bool is_windows()
+{
+#ifdef _WIN32
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Matches wildcardtl, which ignores case on Windows
+static std::string fold(const std::string_view str)
+{
+    std::string ret(str);
+
+    if (is_windows())
+    {
+        for (char& c : ret)
+        {
+            c = static_cast<char>(std::tolower
+                (static_cast<unsigned char>(c)));
+        }
+    }
+
+    return ret;
+}
+
+void escape_regex(const char c, std::string& regex)
+{
+    if (std::string_view("\\^$.|?*+()[]{}\"/").find(c) !=
+        std::string_view::npos)
+    {
+        regex += '\\';
+    }
+
+    regex += c;
+}
+
+std::size_t bracket_to_regex(const std::string_view pattern,
+    const std::size_t idx, std::string& regex)
+{
+    const std::size_t size = pattern.size();
+    std::size_t end = idx + 1;
+
+    if (end < size && (pattern[end] == '!' || pattern[end] == '^'))
+        ++end;
+
+    // A leading ']' is part of the set
+    if (end < size && pattern[end] == ']')
+        ++end;
+
+    end = pattern.find(']', end);
+
+    if (end == std::string_view::npos)
+        return end;
+
+    std::size_t curr = idx + 1;
+
+    regex += '[';
+
+    if (pattern[curr] == '!' || pattern[curr] == '^')
+    {
+        regex += '^';
+        ++curr;
+    }
+
+    for (const std::size_t first = curr; curr < end; ++curr)
+    {
+        const char c = pattern[curr];
+
+        // A '-' is only a range between two characters
+        if (c == '-' && curr != first && curr + 1 != end)
+            regex += c;
+        else if (c == '\\' || c == '^' || c == '[' || c == ']' || c == '-')
+        {
+            regex += '\\';
+            regex += c;
+        }
+        else
+            regex += c;
+    }
+
+    regex += ']';
+    return end;
+}
+
+// Converts a wildcard to lexertl regex syntax.
+// '*' and '?' match any character, including the path separator.
+static std::string to_regex(const std::string& pattern)
+{
+    std::string regex;
+
+    for (std::size_t idx = 0, size = pattern.size(); idx < size; ++idx)
+    {
+        const char c = pattern[idx];
+
+        if (c == '*')
+            regex += "(?s:.)*";
+        else if (c == '?')
+            regex += "(?s:.)";
+        else if (const std::size_t end = c == '[' ?
+            bracket_to_regex(pattern, idx, regex) :
+            std::string::npos; end != std::string::npos)
+        {
+            idx = end;
+        }
+        else
+            // Including an unterminated '['
+            escape_regex(c, regex);
+    }
+
+    return regex;
+}
+
+void glob_set::insert(const std::string& pattern)
+{
+    const std::size_t wc_idx = pattern.find_first_of("*?[");
+
+    if (wc_idx == std::string::npos)
+        _literals.insert(fold(pattern));
+    else if (wc_idx == 0 && pattern.size() > 1 &&
+        pattern.find_first_of("*?[", 1) == std::string::npos)
+    {
+        const std::string suffix = fold(pattern.substr(1));
+
+        _suffixes.insert(suffix);
+
+        if (std::ranges::find(_suffix_lengths, suffix.size()) ==
+            _suffix_lengths.end())
+        {
+            _suffix_lengths.push_back(suffix.size());
+        }
+    }
+    else
+        _regexes.push_back(to_regex(pattern));
+}
+
+void glob_set::build()
+{
+    if (_regexes.empty())
+        return;
+
+    lexertl::rules rules;
+
+    if (is_windows())
+        rules.flags(*lexertl::regex_flags::icase);
+
+    for (const auto& regex : _regexes)
+    {
+        rules.push(regex, 1);
+    }
+
+    lexertl::generator::build(rules, _sm);
+    _sm.minimise();
+    _regexes.clear();
+}
+
+bool glob_set::match(const std::string_view pathname) const
+{
+    const std::string folded = is_windows() ?
+        fold(pathname) :
+        std::string();
+    const std::string_view str = is_windows() ?
+        std::string_view(folded) :
+        pathname;
+
+    if (_literals.contains(str))
+        return true;
+
+    for (const std::size_t length : _suffix_lengths)
+    {
+        if (length <= str.size() &&
+            _suffixes.contains(str.substr(str.size() - length)))
+        {
+            return true;
+        }
+    }
+
+    if (!_sm.empty() && !pathname.empty())
+    {
+        lexertl::cmatch results(pathname.data(),
+            pathname.data() + pathname.size());
+
+        // Longest match, so if any pattern matches the whole
+        // pathname the match ends at the end of the pathname.
+        lexertl::lookup(_sm, results);
+        return results.id == 1 && results.second == results.eoi;
+    }
+
+    return false;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <lexertl/state_machine.hpp>
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+// Pathnames are matched case insensitively and with either separator
+bool is_windows();
+// Appends c to regex, escaped if it is a lexertl regex operator.
+void escape_regex(const char c, std::string& regex);
+// Appends the lexertl equivalent of the wildcard bracket expression
+// starting at pattern[idx] to regex and returns the index of the
+// closing ']'. Returns npos (appending nothing) if it is unterminated.
+std::size_t bracket_to_regex(const std::string_view pattern,
+    const std::size_t idx, std::string& regex);
+
+// A set of wildcards matched in one go, rather than one wildcard at a time.
+// Plain names are found by hash lookup, "*literal" patterns (extensions
+// and the "*/name" patterns generated for -r) by hashing the tail of the
+// pathname, and everything else through a single DFA built from all the
+// remaining patterns.
+class glob_set
+{
+public:
+    void insert(const std::string& pattern);
+    // Call once all the patterns have been inserted
+    void build();
+
+    bool empty() const
+    {
+        return _literals.empty() && _suffixes.empty() && _sm.empty();
+    }
+
+    // True if any pattern matches the whole of pathname.
+    bool match(std::string_view pathname) const;
+
+private:
+    struct string_hash
+    {
+        using is_transparent = void;
+
+        std::size_t operator()(const std::string_view str) const
+        {
+            return std::hash<std::string_view>()(str);
+        }
+    };
+
+    using string_set =
+        std::unordered_set<std::string, string_hash, std::equal_to<>>;
+
+    string_set _literals;
+    string_set _suffixes;
+    // Distinct lengths in _suffixes
+    std::vector<std::size_t> _suffix_lengths;
+    // Patterns converted to lexertl regex syntax, pending build()
+    std::vector<std::string> _regexes;
+    lexertl::state_machine _sm;
+};
@@ -0,0 +1,15 @@
+#include "pch.h"
+
+#include "types.hpp"
+
+#include <boost/regex.hpp>
+
+// The state shared with the translation units outside main.cpp, kept here
+// so that the search code links without main.cpp (see tests/alloc_test.cpp).
+boost::regex g_capture_rx(R"(\$\d+)");
+condition_parser g_condition_parser;
+config_parser g_config_parser;
+ret_parser g_ret_parser;
+parser* g_curr_parser = nullptr;
+uparser* g_curr_uparser = nullptr;
+options g_options;
@@ -0,0 +1,224 @@
+#include "pch.h"
+
+#include "args.hpp"
+#include "glob_set.hpp"
+#include "ignore.hpp"
+#include "output.hpp"
+#include "types.hpp"
+
+#include <lexertl/enums.hpp>
+#include <lexertl/generator.hpp>
+#include <lexertl/lookup.hpp>
+#include <lexertl/match_results.hpp>
+#include <lexertl/rules.hpp>
+
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+extern options g_options;
+
+namespace fs = std::filesystem;
+
+// Leaves room for the npos and skip ids
+static constexpr std::size_t g_max_rules = 0xfffd;
+
+static std::string separator()
+{
+    std::string regex;
+
+    escape_regex(static_cast<char>(fs::path::preferred_separator), regex);
+    return regex;
+}
+
+// Converts a line of a .gitignore file to lexertl regex syntax, matching
+// a pathname relative to the directory of the .gitignore file (with a
+// trailing separator if the pathname is a directory).
+// Returns false for blank lines and comments.
+static bool to_regex(std::string_view line, std::string& regex, bool& negate)
+{
+    const std::string sep = separator();
+    const std::string not_sep = "[^" + sep + ']';
+    bool dir_only = false;
+
+    if (line.ends_with('\r'))
+        line.remove_suffix(1);
+
+    // Trailing spaces are ignored unless escaped
+    while (line.ends_with(' ') && !line.ends_with("\\ "))
+        line.remove_suffix(1);
+
+    if (line.empty() || line[0] == '#')
+        return false;
+
+    negate = line[0] == '!';
+
+    if (negate)
+        line.remove_prefix(1);
+
+    if (line.ends_with('/'))
+    {
+        dir_only = true;
+        line.remove_suffix(1);
+    }
+
+    if (line.empty())
+        return false;
+
+    regex.clear();
+
+    // A separator anywhere but the end anchors the pattern to this
+    // directory, otherwise it matches at any depth.
+    if (line.find('/') == std::string_view::npos)
+        regex = "((?s:.)*" + sep + ")?";
+    else if (line[0] == '/')
+        line.remove_prefix(1);
+
+    for (std::size_t idx = 0, size = line.size(); idx < size; ++idx)
+    {
+        const char c = line[idx];
+
+        if (c == '*' && idx + 1 < size && line[idx + 1] == '*' &&
+            (idx == 0 || line[idx - 1] == '/') &&
+            (idx + 2 == size || line[idx + 2] == '/'))
+        {
+            if (idx + 2 == size)
+                // Everything below
+                regex += "(?s:.)*";
+            else
+                // Zero or more directories
+                regex += "((?s:.)*" + sep + ")?";
+
+            idx += 2;
+        }
+        else if (c == '*')
+        {
+            regex += not_sep + '*';
+
+            // Any other run of '*' is the same as one
+            while (idx + 1 < size && line[idx + 1] == '*')
+                ++idx;
+        }
+        else if (c == '?')
+            regex += not_sep;
+        else if (const std::size_t end = c == '[' ?
+            bracket_to_regex(line, idx, regex) :
+            std::string_view::npos; end != std::string_view::npos)
+        {
+            idx = end;
+        }
+        else if (c == '\\' && idx + 1 < size)
+            escape_regex(line[++idx], regex);
+        else if (c == '/')
+            regex += sep;
+        else
+            escape_regex(c, regex);
+    }
+
+    regex += dir_only ? sep : '(' + sep + ")?";
+    return true;
+}
+
+std::shared_ptr<const ignore_rules> ignore_rules::load(const std::string& dir,
+    std::shared_ptr<const ignore_rules> parent)
+{
+    auto rules = std::make_shared<ignore_rules>();
+    std::vector<std::string> regexes;
+
+    rules->_dir = dir;
+
+    if (!dir.empty() && dir.back() != fs::path::preferred_separator)
+        rules->_dir += fs::path::preferred_separator;
+
+    rules->read(rules->_dir + ".gitignore", regexes);
+    rules->read(rules->_dir + ".ignore", regexes);
+
+    if (regexes.empty())
+        return parent;
+
+    try
+    {
+        lexertl::rules lrules;
+
+        if (is_windows())
+            lrules.flags(*lexertl::regex_flags::icase);
+
+        // lexertl prefers the rule pushed first, but the last
+        // matching line is the one that counts.
+        for (std::size_t idx = regexes.size(); idx-- > 0;)
+        {
+            lrules.push(regexes[idx], static_cast<uint16_t>(idx + 1));
+        }
+
+        lexertl::generator::build(lrules, rules->_sm);
+        rules->_sm.minimise();
+    }
+    catch (const std::exception& e)
+    {
+        if (!g_options._no_messages)
+        {
+            output_text_nl(std::cerr, is_a_tty(stderr),
+                g_options._wa_text.c_str(),
+                std::format("{}ignoring the ignore files in {}: {}",
+                    gg_text(),
+                    dir,
+                    e.what()));
+        }
+
+        return parent;
+    }
+
+    rules->_parent = std::move(parent);
+    return rules;
+}
+
+bool ignore_rules::ignored(const std::string_view pathname,
+    const bool is_dir) const
+{
+    std::string path(pathname);
+
+    if (is_dir)
+        path += fs::path::preferred_separator;
+
+    for (const ignore_rules* rules = this; rules; rules = rules->_parent.get())
+    {
+        lexertl::cmatch results(path.c_str() + rules->_dir.size(),
+            path.c_str() + path.size());
+
+        lexertl::lookup(rules->_sm, results);
+
+        // Longest match, so a match of the whole path ends at eoi
+        if (results.id != results.npos() && results.id != 0 &&
+            results.second == results.eoi)
+        {
+            return !rules->_negate[results.id - 1];
+        }
+    }
+
+    return false;
+}
+
+void ignore_rules::read(const std::string& pathname,
+    std::vector<std::string>& regexes)
+{
+    std::ifstream is(pathname, std::ios::binary);
+    std::string line;
+    std::string regex;
+    bool negate = false;
+
+    while (regexes.size() < g_max_rules && std::getline(is, line))
+    {
+        if (to_regex(line, regex, negate))
+        {
+            regexes.push_back(regex);
+            _negate.push_back(negate);
+        }
+    }
+}
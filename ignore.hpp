@@ -0,0 +1,36 @@
+#pragma once
+
+#include <lexertl/state_machine.hpp>
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The rules from the .gitignore and .ignore files in one directory,
+// chained to the rules of the directories above it.
+// Each directory's rules are compiled (into a single DFA) once, when the
+// directory is listed, and shared by everything below it.
+class ignore_rules
+{
+public:
+    // Returns parent if dir has no ignore files of its own.
+    static std::shared_ptr<const ignore_rules>
+        load(const std::string& dir,
+            std::shared_ptr<const ignore_rules> parent);
+
+    // pathname must be below the directory passed to load().
+    // As with git, the last matching rule in the deepest file with a
+    // matching rule decides.
+    bool ignored(std::string_view pathname, const bool is_dir) const;
+
+private:
+    // With a trailing separator
+    std::string _dir;
+    // Indexed by rule id - 1
+    std::vector<bool> _negate;
+    lexertl::state_machine _sm;
+    std::shared_ptr<const ignore_rules> _parent;
+
+    void read(const std::string& pathname, std::vector<std::string>& regexes);
+};
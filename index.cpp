@@ -0,0 +1,652 @@
+#include "pch.h"
+
+#include "index.hpp"
+#include "version.hpp"
+#include "walk.hpp"
+
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/serialization/string.hpp>
+#include <boost/serialization/unordered_map.hpp>
+#include <boost/serialization/vector.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <ios>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Bump when the layout of the index changes
+static constexpr uint16_t g_index_format = 1;
+// Files with more distinct trigrams than this are left unindexed
+static constexpr std::size_t g_max_trigrams = 1 << 20;
+static constexpr std::size_t g_bits_per_trigram = 8;
+
+// Parser for required_literals()
+struct literal_parser
+{
+    std::string_view _rx;
+    regex_syntax _syntax;
+    std::size_t _idx = 0;
+    // Set if the regex uses something that makes any literals suspect
+    bool _unknown = false;
+
+    // Parses up to the ')' closing the current group (or the end).
+    // Returns false if the sequence contains an alternation.
+    bool sequence(std::vector<std::string>& literals);
+
+private:
+    void group(std::vector<std::string>& literals);
+    void quoted(std::vector<std::string>& literals);
+    void escape(std::string& run, std::vector<std::string>& literals);
+    void skip_class();
+    void skip_quantifier();
+    bool optional() const;
+};
+
+static void flush(std::string& run, std::vector<std::string>& literals)
+{
+    if (!run.empty())
+    {
+        literals.push_back(std::move(run));
+        run.clear();
+    }
+}
+
+// Removes the last (UTF-8) character from run,
+// which a quantifier has just made optional.
+static void drop_last(std::string& run)
+{
+    while (!run.empty() &&
+        (static_cast<unsigned char>(run.back()) & 0xc0) == 0x80)
+    {
+        run.pop_back();
+    }
+
+    if (!run.empty())
+        run.pop_back();
+}
+
+bool literal_parser::sequence(std::vector<std::string>& literals)
+{
+    std::vector<std::string> local;
+    std::string run;
+    bool alternation = false;
+
+    while (_idx < _rx.size() && _rx[_idx] != ')')
+    {
+        const char c = _rx[_idx];
+
+        switch (c)
+        {
+        case '|':
+            alternation = true;
+            flush(run, local);
+            ++_idx;
+            break;
+        case '(':
+            flush(run, local);
+            group(local);
+            break;
+        case '[':
+            flush(run, local);
+            skip_class();
+            break;
+        case '\\':
+            escape(run, local);
+            break;
+        case '*':
+        case '?':
+            drop_last(run);
+            flush(run, local);
+            ++_idx;
+            break;
+        case '{':
+            // A quantifier or (for lexertl) a macro
+            if (optional())
+                drop_last(run);
+
+            flush(run, local);
+            skip_quantifier();
+            break;
+        case '+':
+        case '.':
+        case '^':
+        case '$':
+            flush(run, local);
+            ++_idx;
+            break;
+        case '"':
+            if (_syntax == regex_syntax::lexertl)
+            {
+                flush(run, local);
+                quoted(local);
+            }
+            else
+            {
+                run += c;
+                ++_idx;
+            }
+
+            break;
+        case '/':
+            // lexertl trailing context
+            if (_syntax == regex_syntax::lexertl)
+                flush(run, local);
+            else
+                run += c;
+
+            ++_idx;
+            break;
+        default:
+            run += c;
+            ++_idx;
+            break;
+        }
+    }
+
+    flush(run, local);
+
+    if (alternation)
+        return false;
+
+    literals.insert(literals.end(), local.begin(), local.end());
+    return true;
+}
+
+void literal_parser::group(std::vector<std::string>& literals)
+{
+    bool required = true;
+    std::vector<std::string> sub;
+
+    ++_idx;
+
+    if (_idx < _rx.size() && _rx[_idx] == '?')
+    {
+        // (?:...), (?i), (?i:...) and the like. Anything else
+        // (look around, comments, named groups) is not required.
+        const std::size_t end = _rx.find_first_of(":)", _idx);
+        const std::string_view flags = _rx.substr(_idx + 1,
+            end == std::string_view::npos ? end : end - _idx - 1);
+
+        if (!std::ranges::all_of(flags, [](const char f)
+            {
+                return std::isalpha(static_cast<unsigned char>(f)) ||
+                    f == '-';
+            }))
+        {
+            required = false;
+        }
+        else if (flags.find('x') != std::string_view::npos)
+            // Free spacing changes what a literal is
+            _unknown = true;
+        else if (end != std::string_view::npos && _rx[end] == ')')
+        {
+            // Just flags, no contents
+            _idx = end + 1;
+            return;
+        }
+        else if (end != std::string_view::npos)
+            _idx = end + 1;
+    }
+
+    const bool simple = sequence(sub);
+
+    if (_idx < _rx.size())
+        // Closing ')'
+        ++_idx;
+    else
+        // Unbalanced
+        _unknown = true;
+
+    if (simple && required && !optional())
+        literals.insert(literals.end(), sub.begin(), sub.end());
+}
+
+// lexertl "quoted string"
+void literal_parser::quoted(std::vector<std::string>& literals)
+{
+    std::vector<std::string> local;
+    std::string str;
+
+    for (++_idx; _idx < _rx.size() && _rx[_idx] != '"'; ++_idx)
+    {
+        if (_rx[_idx] == '\\')
+        {
+            // Escapes within quotes are not worth interpreting
+            flush(str, local);
+            ++_idx;
+        }
+        else
+            str += _rx[_idx];
+    }
+
+    if (_idx < _rx.size())
+        ++_idx;
+
+    flush(str, local);
+
+    // A quantifier applies to the whole string
+    if (!optional())
+        literals.insert(literals.end(), local.begin(), local.end());
+}
+
+void literal_parser::escape(std::string& run, std::vector<std::string>& literals)
+{
+    if (_idx + 1 >= _rx.size())
+    {
+        ++_idx;
+        return;
+    }
+
+    const char c = _rx[_idx + 1];
+
+    _idx += 2;
+
+    if (_syntax == regex_syntax::basic)
+    {
+        switch (c)
+        {
+        case '{':
+            // \{n,m\}
+            drop_last(run);
+            flush(run, literals);
+
+            if (const std::size_t end = _rx.find("\\}", _idx);
+                end != std::string_view::npos)
+            {
+                _idx = end + 2;
+            }
+
+            break;
+        case '(':
+        case ')':
+        case '|':
+            // Groups and alternation, which this does not follow
+            _unknown = true;
+            break;
+        default:
+            flush(run, literals);
+            break;
+        }
+    }
+    else if (std::isalnum(static_cast<unsigned char>(c)))
+    {
+        // Character classes, assertions, back references and codes,
+        // none of which are taken as literals. Skip the arguments of
+        // codes so that they are not mistaken for literals.
+        flush(run, literals);
+
+        if (c == 'x' || c == 'u' || c == 'p' || c == 'P' || c == 'k' ||
+            c == 'g' || c == 'c' || c == 'N' ||
+            std::isdigit(static_cast<unsigned char>(c)))
+        {
+            if (_idx < _rx.size() && (_rx[_idx] == '{' ||
+                _rx[_idx] == '<' || _rx[_idx] == '\''))
+            {
+                const char close = _rx[_idx] == '{' ? '}' :
+                    _rx[_idx] == '<' ? '>' : '\'';
+                const std::size_t end = _rx.find(close, _idx);
+
+                _idx = end == std::string_view::npos ? _rx.size() : end + 1;
+            }
+            else
+            {
+                while (_idx < _rx.size() &&
+                    std::isalnum(static_cast<unsigned char>(_rx[_idx])))
+                {
+                    ++_idx;
+                }
+            }
+        }
+    }
+    else if (c == '<' || c == '>' || c == '`' || c == '\'')
+        // boost word and buffer boundaries
+        flush(run, literals);
+    else
+        run += c;
+}
+
+void literal_parser::skip_class()
+{
+    const std::size_t size = _rx.size();
+
+    ++_idx;
+
+    if (_idx < size && _rx[_idx] == '^')
+        ++_idx;
+
+    if (_idx < size && _rx[_idx] == ']')
+        ++_idx;
+
+    while (_idx < size && _rx[_idx] != ']')
+    {
+        if (_rx[_idx] == '[' && _idx + 1 < size &&
+            (_rx[_idx + 1] == ':' || _rx[_idx + 1] == '.' ||
+                _rx[_idx + 1] == '='))
+        {
+            // [:alpha:] etc.
+            const char terminator[] = { _rx[_idx + 1], ']', '\0' };
+            const std::size_t end = _rx.find(terminator, _idx + 2);
+
+            _idx = end == std::string_view::npos ? size : end + 2;
+            continue;
+        }
+
+        // Taking '\' as an escape even where it is not one can only
+        // extend the class, which loses literals rather than
+        // inventing them.
+        if (_rx[_idx] == '\\')
+            ++_idx;
+
+        ++_idx;
+    }
+
+    if (_idx < size)
+        ++_idx;
+}
+
+void literal_parser::skip_quantifier()
+{
+    const std::size_t end = _rx.find('}', _idx);
+
+    _idx = end == std::string_view::npos ? _rx.size() : end + 1;
+}
+
+// True if a quantifier that allows zero repeats follows
+bool literal_parser::optional() const
+{
+    if (_idx >= _rx.size())
+        return false;
+
+    if (_rx[_idx] == '{')
+    {
+        // {0,n} or {,n} (but not {n,m} or a {macro})
+        return _idx + 1 < _rx.size() &&
+            (_rx[_idx + 1] == '0' || _rx[_idx + 1] == ',');
+    }
+
+    return _rx[_idx] == '?' || _rx[_idx] == '*';
+}
+
+std::vector<std::string> required_literals(const std::string_view regex,
+    const regex_syntax syntax, bool& icase)
+{
+    std::vector<std::string> literals;
+
+    // POSIX grep and egrep treat newlines as alternation
+    if ((syntax == regex_syntax::basic || syntax == regex_syntax::extended) &&
+        regex.find('\n') != std::string_view::npos)
+    {
+        return literals;
+    }
+
+    literal_parser parser{ regex, syntax };
+
+    // Until there is no ')' left to stop at
+    while (parser._idx < regex.size())
+    {
+        if (!parser.sequence(literals))
+        {
+            // Top level alternation
+            literals.clear();
+            return literals;
+        }
+
+        if (parser._idx < regex.size())
+        {
+            // Unbalanced ')'
+            parser._unknown = true;
+            ++parser._idx;
+        }
+    }
+
+    if (parser._unknown)
+        literals.clear();
+
+    // Inline flags may switch case sensitivity anywhere
+    icase = regex.find("(?") != std::string_view::npos;
+    return literals;
+}
+
+static unsigned char fold(const char c)
+{
+    const auto uc = static_cast<unsigned char>(c);
+
+    return uc >= 'A' && uc <= 'Z' ? uc | 0x20 : uc;
+}
+
+static uint32_t trigram(const char* ptr)
+{
+    return static_cast<uint32_t>(fold(ptr[0])) << 16 |
+        static_cast<uint32_t>(fold(ptr[1])) << 8 |
+        fold(ptr[2]);
+}
+
+// The two bits set in a Bloom filter of bits bits for trigram
+static std::pair<std::size_t, std::size_t> bloom_bits(const uint32_t trigram,
+    const std::size_t bits)
+{
+    const uint64_t hash = (trigram + 1ULL) * 0x9e3779b97f4a7c15ULL;
+
+    return { (hash >> 40) & (bits - 1), (hash >> 16) & (bits - 1) };
+}
+
+static std::string index_key()
+{
+    const uint16_t version[] = { g_version };
+
+    return std::format("gram_grep {}.{}.{}.{} index {}",
+        version[0], version[1], version[2], version[3], g_index_format);
+}
+
+void trigram_index::load(const std::string& pathname)
+{
+    std::ifstream is(pathname, std::ios::binary);
+
+    if (!is)
+        return;
+
+    try
+    {
+        boost::archive::binary_iarchive ia(is);
+        std::string key;
+
+        ia & key;
+
+        if (key == index_key())
+            ia & _entries;
+    }
+    catch (const std::exception&)
+    {
+        // Truncated or corrupt, so rebuild
+        _entries.clear();
+    }
+}
+
+void trigram_index::save(const std::string& pathname)
+{
+    std::error_code ec;
+    const fs::path path(pathname);
+    const fs::path temp = pathname +
+        std::format(".{:08x}.tmp", std::random_device()());
+
+    std::erase_if(_entries, [&ec](const auto& pair)
+        {
+            return !pair.second._seen && !fs::exists(pair.first, ec);
+        });
+
+    try
+    {
+        std::ofstream os(temp, std::ios::binary);
+
+        if (!os)
+            return;
+
+        {
+            boost::archive::binary_oarchive oa(os);
+            const std::string key = index_key();
+
+            oa & key;
+            oa & _entries;
+        }
+
+        os.close();
+
+        if (!os)
+            throw std::ios_base::failure("write failed");
+
+        fs::rename(temp, path, ec);
+    }
+    catch (const std::exception&)
+    {
+        ec = std::make_error_code(std::errc::io_error);
+    }
+
+    if (ec)
+        fs::remove(temp, ec);
+}
+
+void trigram_index::require(const std::string_view literal, const bool icase)
+{
+    for (std::size_t idx = 0; idx + 3 <= literal.size(); ++idx)
+    {
+        const char* ptr = literal.data() + idx;
+
+        // The index only folds ASCII
+        if (icase && std::any_of(ptr, ptr + 3, [](const char c)
+            {
+                return (static_cast<unsigned char>(c) & 0x80) != 0;
+            }))
+        {
+            continue;
+        }
+
+        _required.push_back(trigram(ptr));
+    }
+
+    std::ranges::sort(_required);
+    _required.erase(std::ranges::unique(_required).begin(), _required.end());
+}
+
+bool trigram_index::candidate(const std::string& pathname,
+    const file_info& info)
+{
+    if (_required.empty())
+        return true;
+
+    std::scoped_lock lock(_mutex);
+    const auto iter = _entries.find(pathname);
+
+    if (iter == _entries.end())
+        return true;
+
+    entry& e = iter->second;
+
+    if (e._mtime != info._mtime || e._size != info._size)
+        // Stale
+        return true;
+
+    // Keep the entry, as it is still current
+    e._seen = true;
+
+    if (e._bloom.empty())
+        return true;
+
+    const std::size_t bits = e._bloom.size() * 64;
+
+    return std::ranges::all_of(_required, [&e, bits](const uint32_t t)
+        {
+            const auto [lhs, rhs] = bloom_bits(t, bits);
+
+            return (e._bloom[lhs / 64] >> (lhs % 64) & 1) &&
+                (e._bloom[rhs / 64] >> (rhs % 64) & 1);
+        });
+}
+
+void trigram_index::update(const std::string& pathname, const file_info& info,
+    const char* first, const char* second, const bool binary)
+{
+    {
+        std::scoped_lock lock(_mutex);
+        const auto iter = _entries.find(pathname);
+
+        if (iter != _entries.end() && iter->second._mtime == info._mtime &&
+            iter->second._size == info._size)
+        {
+            iter->second._seen = true;
+            return;
+        }
+    }
+
+    entry e;
+    std::vector<uint32_t> trigrams;
+
+    e._mtime = info._mtime;
+    e._size = info._size;
+    e._seen = true;
+
+    if (!binary && second - first >= 3)
+    {
+        // One bit per possible trigram (2MB), cleared again after use
+        static thread_local std::vector<uint64_t> seen;
+
+        if (seen.empty())
+            seen.resize((std::size_t{ 1 } << 24) / 64);
+
+        for (const char* ptr = first; ptr + 3 <= second; ++ptr)
+        {
+            const uint32_t t = trigram(ptr);
+            uint64_t& word = seen[t / 64];
+            const uint64_t bit = 1ULL << (t % 64);
+
+            if (!(word & bit))
+            {
+                word |= bit;
+                trigrams.push_back(t);
+
+                // Too many to index, so give up early
+                if (trigrams.size() > g_max_trigrams)
+                    break;
+            }
+        }
+
+        for (const uint32_t t : trigrams)
+        {
+            seen[t / 64] = 0;
+        }
+    }
+
+    if (!binary && trigrams.size() <= g_max_trigrams)
+    {
+        const std::size_t bits = std::max<std::size_t>(64,
+            std::bit_ceil(trigrams.size() * g_bits_per_trigram));
+
+        e._bloom.assign(bits / 64, 0);
+
+        for (const uint32_t t : trigrams)
+        {
+            const auto [lhs, rhs] = bloom_bits(t, bits);
+
+            e._bloom[lhs / 64] |= 1ULL << (lhs % 64);
+            e._bloom[rhs / 64] |= 1ULL << (rhs % 64);
+        }
+    }
+
+    std::scoped_lock lock(_mutex);
+
+    _entries[pathname] = std::move(e);
+}
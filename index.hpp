@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+struct file_info;
+
+enum class regex_syntax
+{
+    ecmascript, basic, extended, lexertl
+};
+
+// Returns literal strings that every match of regex must contain.
+// Conservative: anything that is not understood ends the current literal,
+// and alternations and optional groups contribute nothing.
+// icase is set if the regex contains inline flags.
+std::vector<std::string> required_literals(const std::string_view regex,
+    const regex_syntax syntax, bool& icase);
+
+// On disk trigram index (--build-index and --use-index).
+// Each file is summarised by a Bloom filter of its (ASCII case folded)
+// trigrams, stored against the file's size and modification time.
+// Stale or missing entries never rule a file out, so the index only
+// has to be rebuilt for files that have changed.
+class trigram_index
+{
+public:
+    void load(const std::string& pathname);
+    // Best effort, like config_cache.
+    // Entries for files not seen this run are dropped if the file has
+    // been deleted.
+    void save(const std::string& pathname);
+
+    // Any match must contain literal
+    void require(const std::string_view literal, const bool icase);
+    // False if the index shows that pathname cannot match
+    bool candidate(const std::string& pathname, const file_info& info);
+    // Refreshes the entry for pathname if it is stale.
+    // Binary files are recorded as unindexed (always a candidate).
+    void update(const std::string& pathname, const file_info& info,
+        const char* first, const char* second, const bool binary);
+
+private:
+    struct entry
+    {
+        std::int64_t _mtime = 0;
+        std::uint64_t _size = 0;
+        // Empty if the file is not indexed
+        std::vector<std::uint64_t> _bloom;
+        // Not saved
+        bool _seen = false;
+
+        template<typename archive>
+        void serialize(archive& ar, const unsigned int)
+        {
+            ar & _mtime;
+            ar & _size;
+            ar & _bloom;
+        }
+    };
+
+    std::mutex _mutex;
+    std::unordered_map<std::string, entry> _entries;
+    std::vector<std::uint32_t> _required;
+};
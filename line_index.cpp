@@ -0,0 +1,72 @@
+#include "pch.h"
+
+#include "line_index.hpp"
+#include "scan.hpp"
+
+#include <cstring>
+
+void line_index::reset(const char* first, const char* second)
+{
+    _first = first;
+    _second = second;
+    _pos = first;
+    _line = 0;
+}
+
+std::size_t line_index::line(const char* ptr)
+{
+    if (ptr >= _pos)
+        _line += count_bytes(_pos, ptr, '\n');
+    else if (ptr - _first < _pos - ptr)
+        _line = count_bytes(_first, ptr, '\n');
+    else
+        _line -= count_bytes(ptr, _pos, '\n');
+
+    _pos = ptr;
+    return _line;
+}
+
+const char* line_index::newline(const std::size_t nth)
+{
+    if (nth == 0)
+        return _second;
+
+    if (nth > _line)
+    {
+        // Search forwards from the cursor
+        for (const char* ptr = _pos; ; ++ptr)
+        {
+            ptr = static_cast<const char*>(std::memchr(ptr, '\n',
+                _second - ptr));
+
+            if (!ptr)
+                return _second;
+
+            if (++_line == nth)
+            {
+                // _pos is left on the newline itself
+                --_line;
+                _pos = ptr;
+                return ptr;
+            }
+
+            _pos = ptr + 1;
+        }
+    }
+
+    // The last '\n' before the cursor is the _line th
+    for (const char* ptr = _pos; ptr != _first; )
+    {
+        if (*--ptr == '\n')
+        {
+            if (_line-- == nth)
+            {
+                _pos = ptr;
+                return ptr;
+            }
+        }
+    }
+
+    // Unreachable as nth <= _line
+    return _second;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+
+// Line numbers (count of preceding '\n') for positions in a buffer.
+// Remembers the last position looked up, so a series of lookups moving
+// through the buffer (the usual case when printing matches) costs time
+// proportional to the distance moved rather than the distance from the
+// start of the buffer.
+class line_index
+{
+public:
+    void reset(const char* first, const char* second);
+
+    // Zero based line number of ptr.
+    std::size_t line(const char* ptr);
+    // Returns a pointer to the nth '\n' (one based), or the end of the
+    // buffer if there is no such newline (or nth is zero).
+    const char* newline(const std::size_t nth);
+
+private:
+    const char* _first = nullptr;
+    const char* _second = nullptr;
+    // Cursor: _line is the number of '\n' in [_first, _pos)
+    const char* _pos = nullptr;
+    std::size_t _line = 0;
+};
@@ -3,14 +3,22 @@
 
 #include "pch.h"
 
+#include "arena.hpp"
 #include "args.hpp"
 #include "colours.hpp"
 #include "gg_error.hpp"
+#include "ignore.hpp"
+#include "index.hpp"
 #include "output.hpp"
 #include "parser.hpp"
+#include "posix_regex.hpp"
+#include "scan.hpp"
 #include "search.hpp"
+#include "thread_pool.hpp"
+#include "transcode.hpp"
 #include "types.hpp"
 #include "version.hpp"
+#include "walk.hpp"
 
 #include <lexertl/debug.hpp>
 #include <lexertl/dot.hpp>
@@ -40,22 +48,32 @@
 #include <format>
 #include <fstream>
 #include <functional>
+#include <future>
 #include <iosfwd>
 #include <iostream>
+#include <iterator>
 #include <map>
 
 #ifdef _WIN32
 #include <minwindef.h>
 #include <processenv.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
 #include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <queue>
+#include <random>
+#include <span>
 #include <sstream>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
 #include <system_error>
+#include <thread>
 #include <type_traits>
 #include <utility>
 #include <variant>
@@ -68,26 +86,44 @@ extern const char* try_help();
 extern std::string unescape(const std::string_view& vw);
 extern const char* usage();
 
+extern boost::regex g_capture_rx;
+extern condition_parser g_condition_parser;
+extern config_parser g_config_parser;
+extern ret_parser g_ret_parser;
+extern parser* g_curr_parser;
+extern uparser* g_curr_uparser;
+extern options g_options;
+
 enum class file_type
 {
     ansi, binary, utf8, utf16, utf16_flip
 };
 
-using match_rev_iter = std::reverse_iterator<std::vector<match>::iterator>;
+// Output of a single file searched by a worker thread
+struct file_output
+{
+    std::ostringstream _ss;
+    // A separator is due if a previously output file had hits
+    bool _separator = false;
+    bool _hits = false;
+};
+
+using match_rev_iter = std::reverse_iterator<match_vector::iterator>;
 namespace fs = std::filesystem;
 
-boost::regex g_capture_rx(R"(\$\d+)");
 condition_map g_conditions;
-condition_parser g_condition_parser;
-config_parser g_config_parser;
-ret_parser g_ret_parser;
-parser* g_curr_parser = nullptr;
-uparser* g_curr_uparser = nullptr;
-std::size_t g_files = 0;
-std::size_t g_hits = 0;
-options g_options;
+// Context for the main thread (totals once searching is complete)
+search_context g_context;
+bool g_flushed_hits = false;
+trigram_index g_index;
+std::mutex g_output_mutex;
 pipeline g_pipeline;
-std::size_t g_searched = 0;
+actions g_print_script;
+actions g_replace_script;
+std::vector<search_context> g_worker_contexts;
+
+static thread_local file_output* t_file_output = nullptr;
+static thread_local search_arena t_arena;
 
 static file_type fetch_file_type(const char* data, std::size_t size)
 {
@@ -119,9 +155,14 @@ static file_type fetch_file_type(const char* data, std::size_t size)
 
         if (type == file_type::ansi)
         {
-            const char* second = data + size;
-
-            if (std::find(data, second, '\0') != second)
+            // Only the start of the file is checked. Unlike before
+            // --binary-probe, a NUL past the probe no longer makes the
+            // whole file binary (--binary-probe=0 restores that).
+            const std::size_t probe = g_options._binary_probe ?
+                std::min(size, g_options._binary_probe) :
+                size;
+
+            if (std::memchr(data, '\0', probe))
                 type = file_type::binary;
         }
     }
@@ -129,9 +170,33 @@ static file_type fetch_file_type(const char* data, std::size_t size)
     return type;
 }
 
+// A hole in a sparse file reads as NUL bytes, so the file is binary.
+// This avoids reading past the probe to find out. Only called when the
+// walk saw fewer blocks than the size needs, as compressed file systems
+// report that too.
+static bool has_hole(const std::string& pathname, const std::size_t size)
+{
+    bool hole = false;
+
+#ifdef SEEK_HOLE
+    if (const int fd = ::open(pathname.c_str(), O_RDONLY); fd != -1)
+    {
+        const off_t offset = ::lseek(fd, 0, SEEK_HOLE);
+
+        hole = offset != -1 && static_cast<std::size_t>(offset) < size;
+        ::close(fd);
+    }
+#else
+    static_cast<void>(pathname);
+    static_cast<void>(size);
+#endif
+
+    return hole;
+}
+
 static file_type load_file(std::vector<unsigned char>& utf8,
     const char*& data_first, const char*& data_second,
-    std::vector<match>& ranges)
+    match_vector& ranges)
 {
     const std::size_t size = data_second - data_first;
     file_type type = fetch_file_type(data_first, size);
@@ -139,48 +204,14 @@ static file_type load_file(std::vector<unsigned char>& utf8,
     switch (type)
     {
     case file_type::utf16:
-    {
-        auto first = std::bit_cast<const uint16_t*>(data_first + 2);
-        auto second = std::bit_cast<const uint16_t*>(data_second);
-        utf16_in_iterator in(first, second);
-        utf16_in_iterator in_end(second, second);
-        utf8_out_iterator out(in, in_end);
-        utf8_out_iterator out_end(in_end, in_end);
-
-        utf8.reserve(size / 2 - 1);
-
-        for (; out != out_end; ++out)
-        {
-            utf8.push_back(*out);
-        }
-
-        data_first = std::bit_cast<const char*>(&utf8.front());
-        data_second = data_first + utf8.size();
-        ranges.emplace_back(data_first, data_first, data_second);
-        break;
-    }
     case file_type::utf16_flip:
     {
-        using in_flip_iter = lexertl::basic_utf16_in_iterator
-            <lexertl::basic_flip_iterator<const uint16_t*>, int32_t>;
-        using out_flip_iter = lexertl::basic_utf8_out_iterator<in_flip_iter>;
-        lexertl::basic_flip_iterator
-            first(std::bit_cast<const uint16_t*>(data_first + 2));
-        lexertl::basic_flip_iterator
-            second(std::bit_cast<const uint16_t*>(data_second));
-        in_flip_iter in(first, second);
-        in_flip_iter in_end(second, second);
-        out_flip_iter out(in, in_end);
-        out_flip_iter out_end(in_end, in_end);
-
-        utf8.reserve(size / 2 - 1);
-
-        for (; out != out_end; ++out)
-        {
-            utf8.push_back(*out);
-        }
+        auto first = std::bit_cast<const uint16_t*>(data_first + 2);
+        // Ignore any trailing odd byte
+        auto second = first + (size - 2) / 2;
 
-        data_first = std::bit_cast<const char*>(&utf8.front());
+        utf16_to_utf8(first, second, type == file_type::utf16_flip, utf8);
+        data_first = std::bit_cast<const char*>(utf8.data());
         data_second = data_first + utf8.size();
         ranges.emplace_back(data_first, data_first, data_second);
         break;
@@ -197,22 +228,29 @@ static file_type load_file(std::vector<unsigned char>& utf8,
     return type;
 }
 
-static std::string replace_captures(const std::string& text,
-    const capture_vector& captures)
+// Nothing allocated while searching the previous file is still in use
+// once the next one starts, so the arena can be recycled.
+static std::pmr::memory_resource* file_resource()
 {
-    std::string ret;
-    static lexertl::state_machine cap_sm;
+    t_arena.reset();
+    return t_arena.resource();
+}
 
-    if (cap_sm.empty())
-    {
-        lexertl::rules rules;
+static search_context& worker_context()
+{
+    const std::size_t index = thread_pool::worker_index();
 
-        rules.push(R"(\$\d)", 1);
-        lexertl::generator::build(rules, cap_sm);
-    }
+    return index == std::string::npos ?
+        g_context :
+        g_worker_contexts[index];
+}
 
+static std::string replace_captures(const std::string& text,
+    const capture_vector& captures)
+{
+    std::string ret;
     auto i = lexertl::citerator(text.c_str(),
-        text.c_str() + text.size(), cap_sm);
+        text.c_str() + text.size(), capture_lexer());
     lexertl::citerator e;
 
     for (; i != e; ++i)
@@ -235,18 +273,20 @@ static std::string replace_captures(const std::string& text,
     return ret;
 }
 
-static std::string run_script(const std::string& script,
+static std::string run_script(const actions& script,
     const capture_vector& captures)
 {
-    std::string ret;
-    ret_state state = parse_ret(script);
-    std::vector<std::string> productions;
+    search_context& context = worker_context();
+    // Reuse the strings from the previous match
+    std::vector<std::string>& productions = context._productions;
 
-    for (const auto& capture : captures)
-        productions.emplace_back(capture[0]);
+    productions.resize(captures.size());
 
-    ret = state._actions.exec(nullptr, productions, nullptr);
-    return ret;
+    for (std::size_t idx = 0, size = captures.size(); idx < size; ++idx)
+        productions[idx].assign(captures[idx][0]);
+
+    return script.exec(script._commands.back(), productions, nullptr,
+        context._exec);
 }
 
 [[nodiscard]] static bool perform_replacements(const match_rev_iter& iter,
@@ -272,8 +312,8 @@ static std::string run_script(const std::string& script,
             const char* second = iter->_eoi;
 
             if (data._captures.empty())
-                data._replacements[std::make_pair(first - data._first,
-                    second - first)] = g_options._replace;
+                data._replacements.add(first - data._first, second - first,
+                    g_options._replace);
             else
             {
                 std::string replace;
@@ -285,18 +325,11 @@ static std::string run_script(const std::string& script,
                 }
                 else
                 {
-                    ret_state state = parse_ret(g_options._replace_script);
-                    std::vector<std::string> productions;
-
-                    for (const auto& capture : data._captures)
-                        productions.emplace_back(capture[0]);
-
-                    replace = state._actions.exec(nullptr, productions,
-                        nullptr);
+                    replace = run_script(g_replace_script, data._captures);
                 }
 
-                data._replacements[std::make_pair(first - data._first,
-                    second - first)] = replace;
+                data._replacements.add(first - data._first, second - first,
+                    replace);
             }
         }
     }
@@ -318,13 +351,13 @@ static void print_pathname(const std::string& pathname)
 {
     const std::string_view pn = normalise_pathname(pathname);
 
-    output_text(std::cout, is_a_tty(stdout),
+    output_text(output_stream(), is_a_tty(stdout),
         g_options._fn_text.c_str(), pn);
 }
 
 static void print_separator(const std::string& separator)
 {
-    output_text(std::cout, is_a_tty(stdout),
+    output_text(output_stream(), is_a_tty(stdout),
         g_options._se_text.c_str(), separator);
 }
 
@@ -334,7 +367,7 @@ static void print_prefix(const std::string& pathname,
     if (pathname.empty())
     {
         if (g_options._show_filename == show_filename::yes)
-            output_text(std::cout, is_a_tty(stdout),
+            output_text(output_stream(), is_a_tty(stdout),
                 g_options._fn_text.c_str(), g_options._label);
     }
     else if (g_options._show_filename != show_filename::no)
@@ -356,9 +389,9 @@ static void print_prefix(const std::string& pathname,
 
     if (g_options._line_numbers != line_numbers::none)
     {
-        output_text(std::cout, is_a_tty(stdout),
+        output_text(output_stream(), is_a_tty(stdout),
             g_options._ln_text.c_str(),
-            std::to_string(1 + data._curr_line));
+            std::to_string(1 + data._line_base + data._curr_line));
         print_separator(g_options._line_numbers == line_numbers::with_parens ?
             (')' + separator) :
             separator);
@@ -366,14 +399,14 @@ static void print_prefix(const std::string& pathname,
 
     if (g_options._byte_offset)
     {
-        output_text(std::cout, is_a_tty(stdout),
+        output_text(output_stream(), is_a_tty(stdout),
             g_options._bn_text.c_str(),
-            std::to_string(data._curr - data._first));
+            std::to_string(data._byte_base + (data._curr - data._first)));
         print_separator(separator);
     }
 
     if (g_options._initial_tab)
-        std::cout << '\t';
+        output_stream() << '\t';
 }
 
 static void find_bol(match_data& data)
@@ -395,21 +428,6 @@ static void find_bol(match_data& data)
     }
 }
 
-template<class InputIterator, class NthOccurence, class UnaryPredicate>
-InputIterator find_nth_if(InputIterator first, InputIterator last,
-    NthOccurence Nth, UnaryPredicate pred)
-{
-    if (Nth > 0)
-    {
-        for (; Nth && ++first != last; --Nth)
-            first = std::find_if(first, last, pred);
-
-        return first;
-    }
-    else
-        return last;
-}
-
 [[nodiscard]] static const char* consume_eol(const char* ptr, const char* eoi)
 {
     if (ptr != eoi && *ptr == '\r')
@@ -446,11 +464,7 @@ static std::size_t print_after(const std::string& pathname, match_data& data)
 
         if (before < until)
         {
-            const char* ptr = find_nth_if(data._first, data._second, before,
-                [](const char c)
-                {
-                    return c == '\n';
-                });
+            const char* ptr = data._lines.newline(before);
             const char* curr = data._curr;
             std::size_t curr_line = data._curr_line;
 
@@ -470,15 +484,15 @@ static std::size_t print_after(const std::string& pathname, match_data& data)
                 print_prefix(pathname, data, "-");
 
                 if (data._negate)
-                    std::cout << std::string_view(ptr, end);
+                    output_stream() << std::string_view(ptr, end);
                 else
                 {
-                    output_text(std::cout, is_a_tty(stdout),
+                    output_text(output_stream(), is_a_tty(stdout),
                         g_options._cx_text.c_str(),
                         std::string_view(ptr, end));
                 }
 
-                std::cout << '\n';
+                output_stream() << '\n';
                 end = consume_eol(end, data._second);
                 ptr = end;
             }
@@ -511,11 +525,7 @@ static void print_separators(const std::string& pathname, match_data& data)
 
         if (data._curr_line - data._prev_line > 1)
         {
-            const char* ptr = find_nth_if(data._first, data._second, before,
-                [](const char c)
-                {
-                    return c == '\n';
-                });
+            const char* ptr = data._lines.newline(before);
             const char* curr = data._curr;
             std::size_t curr_line = data._curr_line;
 
@@ -529,7 +539,7 @@ static void print_separators(const std::string& pathname, match_data& data)
                 g_options._before_context)
             {
                 print_separator(g_options._separator);
-                std::cout << '\n';
+                output_stream() << '\n';
             }
 
             for (; before < curr_line; ++before)
@@ -545,12 +555,12 @@ static void print_separators(const std::string& pathname, match_data& data)
                     });
 
                 if (data._negate)
-                    std::cout << std::string_view(first, ptr);
+                    output_stream() << std::string_view(first, ptr);
                 else
-                    output_text(std::cout, is_a_tty(stdout),
+                    output_text(output_stream(), is_a_tty(stdout),
                         g_options._cx_text.c_str(), std::string_view(first, ptr));
 
-                std::cout << '\n';
+                output_stream() << '\n';
                 ptr = consume_eol(ptr, data._second);
                 ++data._curr_line;
             }
@@ -584,31 +594,31 @@ static void display_match(const std::string& pathname,
                 if (g_options._colour && is_a_tty(stdout) &&
                     !g_options._sl_text.empty())
                 {
-                    std::cout << g_options._sl_text;
+                    output_stream() << g_options._sl_text;
 
                     if (!g_options._ne)
-                        std::cout << szEraseEOL;
+                        output_stream() << szEraseEOL;
                 }
 
                 // Print remaining text until the end of line
                 for (; data._bol != data._eol; ++data._bol)
-                    std::cout << *data._bol;
+                    output_stream() << *data._bol;
 
                 if (g_options._colour && is_a_tty(stdout) &&
                     !g_options._sl_text.empty())
                 {
-                    std::cout << szDefaultText;
+                    output_stream() << szDefaultText;
 
                     if (!g_options._ne)
-                        std::cout << szEraseEOL;
+                        output_stream() << szEraseEOL;
                 }
             }
 
-            std::cout << '\n';
+            output_stream() << '\n';
         }
 
         data._prev_line = data._curr_line;
-        data._curr_line = std::count(data._first, data._curr, '\n');
+        data._curr_line = data._lines.line(data._curr);
 
         if (!data._negate)
             print_separators(pathname, data);
@@ -624,7 +634,7 @@ static void display_match(const std::string& pathname,
 
     if (g_options._whole_match)
     {
-        output_text_nl(std::cout, is_a_tty(stdout),
+        output_text_nl(output_stream(), is_a_tty(stdout),
             g_options._ms_text.c_str(), iter->view());
     }
     else if (g_options._only_matching)
@@ -637,7 +647,7 @@ static void display_match(const std::string& pathname,
                 return c == '\r' || c == '\n';
             });
 
-        output_text_nl(std::cout, is_a_tty(stdout),
+        output_text_nl(output_stream(), is_a_tty(stdout),
             g_options._ms_text.c_str(),
             std::string_view(start, data._curr));
     }
@@ -647,29 +657,29 @@ static void display_match(const std::string& pathname,
         {
             if (g_options._colour && is_a_tty(stdout))
             {
-                std::cout << g_options._ms_text;
+                output_stream() << g_options._ms_text;
 
                 if (!g_options._ne)
-                    std::cout << szEraseEOL;
+                    output_stream() << szEraseEOL;
             }
 
             for (; data._bol < data._last; ++data._bol)
-                std::cout << *data._bol;
+                output_stream() << *data._bol;
         }
 
         if (g_options._colour && is_a_tty(stdout) &&
             !g_options._sl_text.empty())
         {
-            std::cout << g_options._sl_text;
+            output_stream() << g_options._sl_text;
 
             if (!g_options._ne)
-                std::cout << szEraseEOL;
+                output_stream() << szEraseEOL;
         }
 
         if (data._bol)
         {
             for (; data._bol < data._curr; ++data._bol)
-                std::cout << *data._bol;
+                output_stream() << *data._bol;
         }
         else
         {
@@ -681,8 +691,8 @@ static void display_match(const std::string& pathname,
                     return c == '\r' || c == '\n';
                 });
 
-            std::cout << std::string_view(first, data._curr);
-            std::cout << '\n';
+            output_stream() << std::string_view(first, data._curr);
+            output_stream() << '\n';
             data._curr = consume_eol(data._curr, data._second);
         }
 
@@ -696,7 +706,7 @@ static void display_match(const std::string& pathname,
                     iter->_second) :
                 data._eol;
 
-            output_text(std::cout, is_a_tty(stdout),
+            output_text(output_stream(), is_a_tty(stdout),
                 g_options._ms_text.c_str(),
                 std::string_view(data._bol, eoi));
             data._bol = eoi;
@@ -708,16 +718,14 @@ static void display_match(const std::string& pathname,
 }
 
 static bool process_matches(match_data& data,
-    std::map<std::pair<std::size_t, std::size_t>,
-    std::string>& temp_replacements, const std::string& pathname)
+    edit_log& temp_replacements, const std::string& pathname)
 {
     bool finished = false;
     const auto& tuple = data._ranges.front();
     auto iter = data._ranges.rbegin();
     auto end = data._ranges.rend();
 
-    data._replacements.insert(temp_replacements.begin(), temp_replacements.end());
-    temp_replacements.clear();
+    data._replacements.splice(temp_replacements);
 
     if (perform_replacements(iter, tuple, data))
         return true;
@@ -733,16 +741,16 @@ static bool process_matches(match_data& data,
             if (g_options._pathname_only == pathname_only::yes)
             {
                 print_pathname(pathname);
-                std::cout << output_nl;
+                output_stream() << output_nl;
                 finished = true;
             }
             else if (!g_options._print.empty())
             {
-                std::cout << build_text(g_options._print, data._captures);
+                output_stream() << build_text(g_options._print, data._captures);
             }
             else if (!g_options._print_script.empty())
             {
-                std::cout << run_script(g_options._print_script,
+                output_stream() << run_script(g_print_script,
                     data._captures);
             }
             else if (!g_options._exec.empty())
@@ -750,10 +758,10 @@ static bool process_matches(match_data& data,
                 const std::string cmd = build_text(g_options._exec,
                     data._captures);
 
-                output_text_nl(std::cout, is_a_tty(stdout),
+                output_text_nl(output_stream(), is_a_tty(stdout),
                     g_options._wa_text.c_str(),
                     std::format("Executing: {}", cmd));
-                std::cout << exec_ret(cmd);
+                output_stream() << exec_ret(cmd);
             }
             else if (g_options._pathname_only != pathname_only::negated &&
                 !g_options._show_count && !g_options._rule_print && !g_options._quiet)
@@ -779,7 +787,7 @@ static bool process_matches(match_data& data,
                 }
 
                 if (data._negate)
-                    data._prev_line = std::count(data._first, data._curr, '\n');
+                    data._prev_line = data._lines.line(data._curr);
             }
 
             if (g_options._show_count)
@@ -797,17 +805,23 @@ static bool process_matches(match_data& data,
                         if (data._eol)
                         {
                             const std::size_t count =
-                                std::count(data._curr, eol, '\n') - 1;
+                                data._lines.line(eol) -
+                                data._lines.line(data._curr) - 1;
 
                             data._count += count;
                         }
                         else
-                            data._count += std::count(data._first,
-                                data._ranges.back()._eoi, '\n');
+                            data._count += data._lines.line(
+                                data._ranges.back()._eoi);
                     }
                     else
-                        data._count += std::count(data._ranges.back()._first,
-                            consume_eol(eol, data._second), '\n');
+                    {
+                        const std::size_t last =
+                            data._lines.line(consume_eol(eol, data._second));
+
+                        data._count += last -
+                            data._lines.line(data._ranges.back()._first);
+                    }
                 }
 
                 data._eol = eol;
@@ -824,16 +838,91 @@ static bool process_matches(match_data& data,
     return finished;
 }
 
-static void perform_output(match_data& data, const std::string& pathname,
-    lexertl::memory_file& mf,
-    const file_type type, const std::size_t size)
+// Writes the searched text with the replacements spliced in, copying the
+// unchanged spans straight from the (mapped) input.
+static void write_replaced(std::ostream& os, const match_data& data)
+{
+    std::size_t last = 0;
+
+    for (const auto& edit : data._replacements.edits())
+    {
+        const std::string_view text = data._replacements.text(edit);
+
+        if (edit._offset > last)
+            os.write(data._first + last, edit._offset - last);
+
+        os.write(text.data(), text.size());
+        last = edit._offset + edit._size;
+    }
+
+    os.write(data._first + last, (data._second - data._first) - last);
+}
+
+static void write_utf16(std::ostream& os, const std::string_view& content,
+    const file_type type)
+{
+    std::vector<uint16_t> utf16;
+
+    utf16.push_back(type == file_type::utf16 ? 0xfeff : 0xfffe);
+    utf8_to_utf16(content, type == file_type::utf16_flip, utf16);
+    os.write(std::bit_cast<const char*>(&utf16.front()),
+        utf16.size() * sizeof(uint16_t));
+}
+
+// Writes the new contents to a temporary file alongside pathname and
+// renames it over pathname, so the file is never left half written.
+static void rewrite_file(const std::string& pathname, const file_info& info,
+    lexertl::memory_file& mf, const std::function<void(std::ostream&)>& write)
+{
+    // Replace the target of a symbolic link rather than the link itself
+    const fs::path target = info._symlink ?
+        fs::canonical(pathname) :
+        fs::path(pathname);
+    fs::path temp = target;
+    std::error_code ec;
+
+    temp += std::format(".{:08x}.tmp", std::random_device()());
+
+    try
+    {
+        std::ofstream os(temp, std::ofstream::binary);
+
+        if (!os)
+            throw gg_error(std::format("Cannot create {}.", temp.string()));
+
+        os.exceptions(std::ofstream::badbit);
+        write(os);
+        os.close();
+
+        if (!os)
+            throw gg_error(std::format("Failed to write {}.", temp.string()));
+
+        fs::permissions(temp, info._perms);
+        // The input may still be mapped, which would block the rename
+        // on Windows
+        mf.close();
+        fs::rename(temp, target);
+    }
+    catch (...)
+    {
+        fs::remove(temp, ec);
+        throw;
+    }
+}
+
+static void perform_output(search_context& context, match_data& data,
+    const std::string& pathname, const file_info& info,
+    lexertl::memory_file& mf, const file_type type)
 {
-    const auto perms = fs::status(pathname.c_str()).permissions();
+    file_info current = info;
 
-    ++g_files;
-    g_hits += data._hits;
+    ++context._files;
+    context._hits += data._hits;
 
-    if ((perms & fs::perms::owner_write) != fs::perms::owner_write)
+    if (t_file_output)
+        t_file_output->_hits = true;
+
+    if ((current._perms & fs::perms::owner_write) != fs::perms::owner_write)
     {
         // Read-only
         if (!g_options._checkout.empty())
@@ -852,26 +941,17 @@ static void perform_output(match_data& data, const std::string& pathname,
                     g_options._checkout));
         }
         else if (g_options._force_write)
-            fs::permissions(pathname.c_str(), perms | fs::perms::owner_write);
+            fs::permissions(pathname.c_str(),
+                current._perms | fs::perms::owner_write);
+
+        // Pick up whatever the checkout or chmod did
+        current._perms = fs::status(pathname.c_str()).permissions();
     }
 
     if (!data._replacements.empty())
     {
-        std::string content(data._first, data._second);
-
-        for (auto iter = data._replacements.rbegin(),
-            end = data._replacements.rend(); iter != end; ++iter)
-        {
-            content.erase(iter->first.first, iter->first.second);
-            content.insert(iter->first.first, iter->second);
-        }
-
-        data._replacements.clear();
-        // In case the memory_file is still open
-        mf.close();
-
-        if ((fs::status(pathname.c_str()).permissions() &
-            fs::perms::owner_write) != fs::perms::owner_write)
+        if ((current._perms & fs::perms::owner_write) !=
+            fs::perms::owner_write)
         {
             if (!g_options._no_messages)
             {
@@ -884,241 +964,116 @@ static void perform_output(match_data& data, const std::string& pathname,
         }
         else
         {
+            if (const std::size_t conflicts = data._replacements.sort();
+                conflicts && !g_options._no_messages)
+            {
+                output_text_nl(std::cerr, is_a_tty(stderr),
+                    g_options._wa_text.c_str(),
+                    std::format("{}{}: ignored {} overlapping replacement(s).",
+                        gg_text(),
+                        pathname,
+                        conflicts));
+            }
+
             switch (type)
             {
             case file_type::utf16:
-            {
-                std::vector<uint16_t> utf16;
-                auto first = std::bit_cast<const unsigned char*>(&content.front());
-                const unsigned char* second = first + content.size();
-                lexertl::basic_utf8_in_iterator<const unsigned char*, int32_t>
-                    iter(first, second);
-                lexertl::basic_utf8_in_iterator<const unsigned char*, int32_t>
-                    end(second, second);
-
-                utf16.reserve(size);
-                utf16.push_back(0xfeff);
-
-                for (; iter != end; ++iter)
-                {
-                    const int32_t val = *iter;
-                    lexertl::basic_utf16_out_iterator<const int32_t*, uint16_t>
-                        out_iter(&val, &val + 1);
-                    lexertl::basic_utf16_out_iterator<const int32_t*, uint16_t>
-                        out_end(&val + 1, &val + 1);
-
-                    for (; out_iter != out_end; ++out_iter)
-                    {
-                        utf16.push_back(*out_iter);
-                    }
-                }
-
-                std::ofstream os(pathname.c_str(), std::ofstream::binary);
-
-                os.exceptions(std::ofstream::badbit);
-                os.write(std::bit_cast<const char*>(&utf16.front()),
-                    utf16.size() * sizeof(uint16_t));
-                os.close();
-                break;
-            }
             case file_type::utf16_flip:
             {
-                std::vector<uint16_t> utf16;
-                auto first = std::bit_cast<const unsigned char*>(&content.front());
-                const unsigned char* second = first + content.size();
-                lexertl::basic_utf8_in_iterator<const unsigned char*, int32_t>
-                    iter(first, second);
-                lexertl::basic_utf8_in_iterator<const unsigned char*, int32_t>
-                    end(second, second);
-
-                utf16.reserve(size);
-                utf16.push_back(0xfffe);
-
-                for (; iter != end; ++iter)
-                {
-                    const int32_t val = *iter;
-                    lexertl::basic_utf16_out_iterator<const int32_t*, uint16_t>
-                        out_iter(&val, &val + 1);
-                    lexertl::basic_utf16_out_iterator<const int32_t*, uint16_t>
-                        out_end(&val + 1, &val + 1);
+                std::ostringstream ss;
 
-                    for (; out_iter != out_end; ++out_iter)
+                write_replaced(ss, data);
+                rewrite_file(pathname, current, mf, [&](std::ostream& os)
                     {
-                        uint16_t flip = *out_iter;
-                        lexertl::basic_flip_iterator flip_iter(&flip);
-
-                        utf16.push_back(*flip_iter);
-                    }
-                }
-
-                std::ofstream os(pathname.c_str(), std::ofstream::binary);
-
-                os.exceptions(std::ofstream::badbit);
-                os.write(std::bit_cast<const char*>(&utf16.front()),
-                    utf16.size() * sizeof(uint16_t));
-                os.close();
+                        write_utf16(os, ss.view(), type);
+                    });
                 break;
             }
             case file_type::utf8:
-            {
-                std::ofstream os(pathname.c_str(), std::ofstream::binary);
-                const unsigned char header[] = { 0xef, 0xbb, 0xbf };
+                rewrite_file(pathname, current, mf, [&data](std::ostream& os)
+                    {
+                        const unsigned char header[] = { 0xef, 0xbb, 0xbf };
 
-                os.exceptions(std::ofstream::badbit);
-                os.write(std::bit_cast<const char*>(&header[0]), sizeof(header));
-                os.write(content.c_str(), content.size());
-                os.close();
+                        os.write(std::bit_cast<const char*>(&header[0]),
+                            sizeof(header));
+                        write_replaced(os, data);
+                    });
                 break;
-            }
             default:
-            {
-                std::ofstream os(pathname.c_str(), std::ofstream::binary);
-
-                os.exceptions(std::ofstream::badbit);
-                os.write(content.c_str(), content.size());
-                os.close();
+                rewrite_file(pathname, current, mf, [&data](std::ostream& os)
+                    {
+                        write_replaced(os, data);
+                    });
                 break;
             }
-            }
         }
+
+        data._replacements.clear();
     }
 }
 
-static void process_file(const std::string& pathname, std::string* cin = nullptr)
+static void hit_separator(const search_context& context)
 {
-    if (g_options._writable && (fs::status(pathname).permissions() &
-        fs::perms::owner_write) == fs::perms::none)
-    {
-        return;
-    }
-
-    lexertl::memory_file mf(pathname.c_str());
-    std::vector<unsigned char> utf8;
-    file_type type = file_type::ansi;
-    match_data data;
-    bool first_hit = true;
-    bool finished = false;
-
-    if (!mf.data() && !cin)
-    {
-        if (!g_options._no_messages)
-        {
-            output_text_nl(std::cerr, is_a_tty(stderr),
-                g_options._wa_text.c_str(),
-                std::format("{}failed to open {}.",
-                    gg_text(),
-                    pathname));
-        }
-
-        return;
-    }
-
-    if (cin)
-    {
-        std::ostringstream ss;
-
-        ss << std::cin.rdbuf();
-        *cin = ss.str();
-        data._first = cin->c_str();
-        data._second = data._first + cin->size();
-    }
-    else
-    {
-        data._first = mf.data();
-        data._second = data._first + mf.size();
-    }
-
-    type = load_file(utf8, data._first, data._second, data._ranges);
-
-    if (type == file_type::utf16 || type == file_type::utf16_flip)
-        // No need for original data
-        mf.close();
-    else if (type == file_type::binary)
+    if (t_file_output)
+        // Deferred until the output is flushed
+        t_file_output->_separator = true;
+    else if (context._hits)
     {
-        switch (g_options._binary_files)
-        {
-        case binary_files::text:
-            type = file_type::ansi;
-            break;
-        case binary_files::without_match:
-            return;
-        default:
-            break;
-        }
+        print_separator(g_options._separator);
+        output_stream() << '\n';
     }
+}
 
-    do
-    {
-        std::map<std::pair<std::size_t, std::size_t>, std::string>
-            temp_replacements;
+// Searches [data._first, data._second), returning false if searching
+// stopped early because a binary file matched.
+static bool search_data(const std::string& pathname, search_context& context,
+    match_data& data, const file_type type, bool& first_hit)
+{
+    bool binary_hit = false;
+    // Edits made by grammar actions are only kept if the search succeeds
+    edit_log temp_replacements(t_arena.resource());
 
-        if (bool success = search(data, temp_replacements);
-            success)
+    search_buffer(g_pipeline, context, data, temp_replacements,
+        [&](edit_log& replacements)
         {
-            if (g_options._hit_separator && g_hits && first_hit &&
+            if (g_options._hit_separator && first_hit &&
                 g_options._pathname_only != pathname_only::negated &&
                 !g_options._show_count && g_options._print.empty() &&
                 !g_options._rule_print && !g_options._quiet)
             {
-                print_separator(g_options._separator);
-                std::cout << '\n';
+                hit_separator(context);
             }
 
             first_hit = false;
 
             if (type == file_type::binary)
             {
-                if (g_options._pathname_only == pathname_only::no)
-                    output_text(std::cout, is_a_tty(stdout),
-                        g_options._fn_text.c_str(),
-                        std::format("{}Binary file ", gg_text()));
-
-                output_text(std::cout, is_a_tty(stdout),
-                    g_options._fn_text.c_str(),
-                    normalise_pathname(pathname));
-
-                if (g_options._pathname_only == pathname_only::no)
-                    output_text(std::cout, is_a_tty(stdout),
-                        g_options._fn_text.c_str(),
-                        " matches");
-
-                std::cout << '\n';
-                return;
+                binary_hit = true;
+                return true;
             }
             else
-            {
-                finished = process_matches(data, temp_replacements, pathname);
-            }
-        }
-        else
-            data._negate = false;
-
-        const match old = data._ranges.back();
-
-        data._ranges.pop_back();
-
-        if (!data._ranges.empty())
-        {
-            // Cleardown any stale strings in matches.
-            // First makes sure current range is not from the same
-            // string (in matches) as the last.
-            if (const auto& curr = data._ranges.back();
-                !data._matches.empty() &&
-                (old._first < curr._first || old._first > curr._eoi))
-            {
-                while (!data._matches.empty() &&
-                    old._first >= data._matches.top().c_str() &&
-                    old._eoi <= data._matches.top().c_str() +
-                    data._matches.top().size())
-                {
-                    data._matches.pop();
-                }
-            }
+                return process_matches(data, replacements, pathname);
+        });
 
-            // Start searching from end of last match
-            data._ranges.back()._first = data._ranges.back()._second;
-        }
-    } while (!finished && !data._ranges.empty());
+    if (binary_hit)
+    {
+        if (g_options._pathname_only == pathname_only::no)
+            output_text(output_stream(), is_a_tty(stdout),
+                g_options._fn_text.c_str(),
+                std::format("{}Binary file ", gg_text()));
+
+        output_text(output_stream(), is_a_tty(stdout),
+            g_options._fn_text.c_str(),
+            normalise_pathname(pathname));
+
+        if (g_options._pathname_only == pathname_only::no)
+            output_text(output_stream(), is_a_tty(stdout),
+                g_options._fn_text.c_str(),
+                " matches");
+
+        output_stream() << '\n';
+        return false;
+    }
 
     if (g_options._pathname_only != pathname_only::negated &&
         !g_options._show_count && g_options._print.empty() &&
@@ -1127,41 +1082,42 @@ static void process_file(const std::string& pathname, std::string* cin = nullptr
         if (g_options._colour && is_a_tty(stdout) &&
             !g_options._sl_text.empty())
         {
-            std::cout << g_options._sl_text;
+            output_stream() << g_options._sl_text;
 
             if (!g_options._ne)
-                std::cout << szEraseEOL;
+                output_stream() << szEraseEOL;
         }
 
         for (; data._bol != data._eol; ++data._bol)
-            std::cout << *data._bol;
+            output_stream() << *data._bol;
 
         if (g_options._colour && is_a_tty(stdout) &&
             !g_options._sl_text.empty())
         {
-            std::cout << szDefaultText;
+            output_stream() << szDefaultText;
 
             if (!g_options._ne)
-                std::cout << szEraseEOL;
+                output_stream() << szEraseEOL;
         }
 
         if (data._bol)
             // Only output newline if there has been at least one match
-            std::cout << '\n';
+            output_stream() << '\n';
 
         data._prev_line = data._curr_line;
-        data._curr_line = std::count(data._first, data._second, '\n');
+        data._curr_line = data._lines.line(data._second);
         data._curr = data._second;
 
         //if (!data._negate)
             print_after(pathname, data);
     }
 
-    if (data._hits)
-    {
-        perform_output(data, pathname, mf, type, utf8.size());
-    }
+    return true;
+}
 
+static void end_file(const std::string& pathname, search_context& context,
+    const match_data& data)
+{
     if (g_options._show_count)
     {
         if (g_options._show_filename != show_filename::no)
@@ -1170,70 +1126,288 @@ static void process_file(const std::string& pathname, std::string* cin = nullptr
             print_separator(":");
         }
 
-        std::cout << data._count << output_nl;
+        output_stream() << data._count << output_nl;
     }
 
     if (g_options._pathname_only == pathname_only::negated && !data._hits)
     {
         print_pathname(pathname);
-        std::cout << output_nl;
+        output_stream() << output_nl;
     }
 
-    ++g_searched;
+    // Output is otherwise only written when the buffer fills
+    if (!t_file_output && is_a_tty(stdout))
+        output_stream() << std::flush;
+
+    ++context._searched;
 }
 
-static bool process_file(const std::string& pathname, const wildcards &wcs)
+// Reads the input in windows of g_options._stream bytes (extended to the
+// end of the line) so that memory use does not depend on the input size.
+// Matches cannot span windows and context lines stop at window
+// boundaries. UTF-16 input is read in full, as before.
+static void process_stream(const std::string& pathname,
+    const file_info& info, std::istream& is)
 {
-    bool process = false;
-    const char* filename = pathname.c_str() +
-        pathname.rfind(fs::path::preferred_separator) + 1;
-    bool skip = !g_options._exclude._negative.empty();
+    search_context& context = worker_context();
+    lexertl::memory_file mf;
+    std::string buffer;
+    std::vector<unsigned char> utf8;
+    file_type type = file_type::ansi;
+    match_data data(file_resource());
+    bool first_hit = true;
+    bool first_window = true;
+    bool eof = false;
 
-    for (const auto& pn : g_options._exclude._negative)
+    while (!eof)
     {
-        if (!pn._wc.match(filename))
-        {
-            skip = false;
-            break;
-        }
-    }
+        std::size_t window = 0;
 
-    if (!skip)
-    {
-        for (const auto& pn : g_options._exclude._positive)
+        // Make sure no line is split across windows
+        do
         {
-            if (pn._wc.match(filename))
+            const std::size_t size = buffer.size();
+
+            buffer.resize(size + g_options._stream);
+            is.read(&buffer[size], g_options._stream);
+            buffer.resize(size + is.gcount());
+            eof = !is;
+
+            // Anything before size has already been checked for '\n'
+            if (const auto iter = std::find(buffer.rbegin(),
+                buffer.rend() - size, '\n'); iter != buffer.rend() - size)
             {
-                skip = true;
-                break;
+                window = buffer.rend() - iter;
             }
-        }
-    }
-
-    if (!skip)
-    {
-        process = !wcs._negative.empty();
+        } while (!eof && window == 0);
 
-        for (const auto& pn : wcs._negative)
+        if (first_window)
         {
-            if (!pn._wc.match(pathname))
+            const file_type ft = fetch_file_type(buffer.c_str(),
+                buffer.size());
+
+            if (ft == file_type::utf16 || ft == file_type::utf16_flip)
             {
-                process = false;
-                break;
+                // Cannot be windowed without splitting code units
+                buffer.append(std::istreambuf_iterator<char>(is),
+                    std::istreambuf_iterator<char>());
+                eof = true;
             }
         }
 
-        if (!process)
-        {
-            for (const auto& pn : wcs._positive)
-            {
-                if (pn._wc.match(pathname))
+        if (eof)
+            window = buffer.size();
+
+        if (window == 0)
+            break;
+
+        data._first = buffer.c_str();
+        data._second = data._first + window;
+        data._bol = data._eol = data._curr = data._last = nullptr;
+        data._ranges.clear();
+
+        while (!data._matches.empty())
+            data._matches.pop();
+
+        data._captures.clear();
+        data._prev_line = 0;
+        data._curr_line = std::string::npos;
+
+        if (first_window)
+        {
+            type = load_file(utf8, data._first, data._second, data._ranges);
+
+            if (type == file_type::binary)
+            {
+                switch (g_options._binary_files)
                 {
-                    process = true;
+                case binary_files::text:
+                    type = file_type::ansi;
+                    break;
+                case binary_files::without_match:
+                    return;
+                default:
                     break;
                 }
             }
         }
+        else
+        {
+            data._ranges.emplace_back(data._first, data._first, data._second);
+
+            // Later windows are only checked for binary content if
+            // the whole file is to be probed
+            if (type == file_type::ansi && g_options._binary_probe == 0 &&
+                g_options._binary_files != binary_files::text &&
+                std::find(data._first, data._second, '\0') != data._second)
+            {
+                if (g_options._binary_files == binary_files::without_match)
+                    break;
+
+                type = file_type::binary;
+            }
+        }
+
+        if (!search_data(pathname, context, data, type, first_hit))
+            return;
+
+        data._line_base += data._lines.line(data._second);
+        data._byte_base += data._second - data._first;
+        buffer.erase(0, window);
+        first_window = false;
+    }
+
+    if (data._hits)
+    {
+        perform_output(context, data, pathname, info, mf, type);
+    }
+
+    end_file(pathname, context, data);
+}
+
+// info comes from the directory walk, which has already applied
+// --writable and skipped empty files.
+static void process_file(const std::string& pathname, const file_info& info,
+    std::string* cin = nullptr)
+{
+    if (!cin && !g_options._use_index.empty() &&
+        !g_index.candidate(pathname, info))
+    {
+        return;
+    }
+
+    if (g_options._stream)
+    {
+        if (cin)
+            process_stream(pathname, info, std::cin);
+        else if (std::ifstream is(pathname, std::ios::binary); is)
+            process_stream(pathname, info, is);
+        else if (!g_options._no_messages)
+        {
+            output_text_nl(std::cerr, is_a_tty(stderr),
+                g_options._wa_text.c_str(),
+                std::format("{}failed to open {}.",
+                    gg_text(),
+                    pathname));
+        }
+
+        return;
+    }
+
+    search_context& context = worker_context();
+    lexertl::memory_file mf(pathname.c_str());
+    std::vector<unsigned char> utf8;
+    file_type type = file_type::ansi;
+    match_data data(file_resource());
+    bool first_hit = true;
+
+    if (!mf.data() && !cin)
+    {
+        if (!g_options._no_messages)
+        {
+            output_text_nl(std::cerr, is_a_tty(stderr),
+                g_options._wa_text.c_str(),
+                std::format("{}failed to open {}.",
+                    gg_text(),
+                    pathname));
+        }
+
+        return;
+    }
+
+    if (cin)
+    {
+        std::ostringstream ss;
+
+        ss << std::cin.rdbuf();
+        *cin = ss.str();
+        data._first = cin->c_str();
+        data._second = data._first + cin->size();
+    }
+    else
+    {
+        data._first = mf.data();
+        data._second = data._first + mf.size();
+    }
+
+    type = load_file(utf8, data._first, data._second, data._ranges);
+
+    if (type == file_type::ansi && info._sparse &&
+        g_options._binary_files != binary_files::text &&
+        g_options._binary_probe && mf.size() > g_options._binary_probe &&
+        has_hole(pathname, mf.size()))
+    {
+        type = file_type::binary;
+    }
+
+    if (!cin && !g_options._build_index.empty())
+    {
+        g_index.update(pathname, info, data._first, data._second,
+            type == file_type::binary);
+    }
+
+    if (type == file_type::utf16 || type == file_type::utf16_flip)
+        // No need for original data
+        mf.close();
+    else if (type == file_type::binary)
+    {
+        switch (g_options._binary_files)
+        {
+        case binary_files::text:
+            type = file_type::ansi;
+            break;
+        case binary_files::without_match:
+            return;
+        default:
+            break;
+        }
+    }
+
+    if (!search_data(pathname, context, data, type, first_hit))
+        return;
+
+    if (data._hits)
+    {
+        perform_output(context, data, pathname, info, mf, type);
+    }
+
+    end_file(pathname, context, data);
+}
+
+static bool process_file(const std::string& pathname, const wildcards &wcs)
+{
+    bool process = false;
+    const char* filename = pathname.c_str() +
+        pathname.rfind(fs::path::preferred_separator) + 1;
+    bool skip = !g_options._exclude._negative.empty();
+
+    for (const auto& pn : g_options._exclude._negative)
+    {
+        if (!pn._wc.match(filename))
+        {
+            skip = false;
+            break;
+        }
+    }
+
+    if (!skip)
+        skip = g_options._exclude._positive_set.match(filename);
+
+    if (!skip)
+    {
+        process = !wcs._negative.empty();
+
+        for (const auto& pn : wcs._negative)
+        {
+            if (!pn._wc.match(pathname))
+            {
+                process = false;
+                break;
+            }
+        }
+
+        if (!process)
+            process = wcs._positive_set.match(pathname);
     }
 
     return process;
@@ -1242,127 +1416,366 @@ static bool process_file(const std::string& pathname, const wildcards &wcs)
 static bool include_file(const std::string& path)
 {
     return (g_options._include._positive.empty() ||
-        std::ranges::any_of(g_options._include._positive,
-            [&path](const auto& pn)
-            {
-                return pn._wc.match(path);
-            })) &&
-        std::ranges::none_of(g_options._include._negative,
-            [&path](const auto& pn)
-            {
-                return pn._wc.match(path);
-            });
+        g_options._include._positive_set.match(path)) &&
+        !g_options._include._negative_set.match(path);
 }
 
 static bool include_dir(const std::string& path)
 {
     return (g_options._exclude_dirs._negative.empty() ||
-        std::ranges::any_of(g_options._exclude_dirs._negative,
-        [&path](const auto& pn)
+        g_options._exclude_dirs._negative_set.match(path)) &&
+        !g_options._exclude_dirs._positive_set.match(path);
+}
+
+// A directory waiting to be listed
+struct dir_task
+{
+    std::string _path;
+    const wildcards* _wcs = nullptr;
+    // --gitignore rules from the directories above
+    std::shared_ptr<const ignore_rules> _ignore;
+};
+
+// Lists the directory, passing sub-directories to push_dir
+// and files that pass the filters to push_file.
+static void list_dir(const dir_task& dir,
+    const std::function<void(dir_task&&)>& push_dir,
+    const std::function<void(std::string&&, const file_info&)>& push_file)
+{
+    const wildcards& wcs = *dir._wcs;
+    const auto ignore = g_options._gitignore ?
+        ignore_rules::load(dir._path, dir._ignore) :
+        nullptr;
+    bool processed = false;
+    dir_reader reader(dir._path);
+    dir_entry entry;
+
+    while (reader.next(entry))
+    {
+        std::string& pathname = entry._pathname;
+        const file_info& info = entry._info;
+        const bool is_dir = info._kind == file_kind::directory;
+
+        if (g_options._gitignore &&
+            ((is_dir && pathname.ends_with(std::string(1,
+                fs::path::preferred_separator) + ".git")) ||
+            (ignore && ignore->ignored(pathname, is_dir))))
         {
-            return pn._wc.match(path);
-        })) &&
-    std::ranges::none_of(g_options._exclude_dirs._positive,
-        [&path](const auto& pn)
+            continue;
+        }
+
+        if (!is_dir || g_options._directories == directories::read)
         {
-            return pn._wc.match(path);
-        });
+            if (!process_file(pathname, wcs))
+                continue;
+        }
+
+        if (is_dir)
+        {
+            switch (g_options._directories)
+            {
+            case directories::read:
+                if (!g_options._no_messages)
+                {
+                    output_text_nl(std::cerr, is_a_tty(stderr),
+                        g_options._wa_text.c_str(),
+                        std::format("{}{}: Is a directory",
+                            gg_text(),
+                            normalise_pathname(pathname)));
+                }
+
+                break;
+            case directories::recurse:
+                if (!(info._symlink && !g_options._follow_symlinks) &&
+                    include_dir(pathname.substr(pathname.
+                    rfind(fs::path::preferred_separator) + 1)))
+                {
+                    push_dir({ std::move(pathname), dir._wcs, ignore });
+                }
+
+                break;
+            case directories::skip:
+                // Do nothing
+                break;
+            }
+        }
+        else
+        {
+            // Skip devices, pipes and dangling links
+            if (info._kind != file_kind::file ||
+                (g_options._writable && (info._perms &
+                fs::perms::owner_write) == fs::perms::none) ||
+                // Skip zero length files
+                info._size == 0)
+            {
+                continue;
+            }
+
+            if (include_file(pathname.substr(pathname.
+                rfind(fs::path::preferred_separator) + 1)))
+            {
+                push_file(std::move(pathname), info);
+                processed = true;
+            }
+        }
+    }
+
+    if (!processed && g_options._directories != directories::recurse &&
+        !g_options._no_messages)
+    {
+        for (const auto& wildcard : wcs._positive)
+        {
+            if (!wildcard._pathname.empty())
+            {
+                output_text_nl(std::cerr, is_a_tty(stderr),
+                    g_options._wa_text.c_str(),
+                    std::format("{}{}: No such file or directory",
+                        gg_text(),
+                        normalise_pathname(wildcard._pathname)));
+            }
+        }
+    }
 }
 
-static void process()
+// Search pathname on a worker thread, buffering the output
+static void search_file(const std::string& pathname, const file_info& info,
+    file_output& output)
+{
+    set_output_stream(&output._ss);
+    t_file_output = &output;
+
+    try
+    {
+        process_file(pathname, info);
+    }
+    catch (...)
+    {
+        set_output_stream(nullptr);
+        t_file_output = nullptr;
+        throw;
+    }
+
+    set_output_stream(nullptr);
+    t_file_output = nullptr;
+}
+
+// Caller must hold g_output_mutex
+static void flush_output(const file_output& output)
+{
+    if (output._separator && g_flushed_hits)
+    {
+        print_separator(g_options._separator);
+        output_stream() << '\n';
+    }
+
+    output_stream() << output._ss.view();
+
+    if (g_options._line_buffered)
+        output_stream() << std::flush;
+
+    g_flushed_hits |= output._hits;
+}
+
+static void process_serial()
 {
-    std::queue<std::pair<std::string, const wildcards*>> queue;
+    std::queue<dir_task> queue;
 
     for (const auto& [path, wcs] : g_options._pathnames)
     {
-        queue.emplace(path, &wcs);
+        queue.push({ path, &wcs, nullptr });
     }
 
     for (; !queue.empty(); queue.pop())
     {
-        const auto& [path, wcs] = queue.front();
-        std::error_code err;
-        bool processed = false;
+        list_dir(queue.front(),
+            [&queue](dir_task&& dir)
+            {
+                queue.push(std::move(dir));
+            },
+            [](std::string&& pathname, const file_info& info)
+            {
+                process_file(pathname, info);
+            });
+    }
+}
 
-        for (auto iter = fs::directory_iterator(path,
-            fs::directory_options::skip_permission_denied, err),
-            end = fs::directory_iterator(); iter != end; ++iter)
+static void list_dir_task(thread_pool& pool, const dir_task& dir)
+{
+    list_dir(dir,
+        [&pool](dir_task&& sub_dir)
+        {
+            pool.submit([&pool, sub_dir = std::move(sub_dir)]()
+                {
+                    list_dir_task(pool, sub_dir);
+                });
+        },
+        [&pool](std::string&& pathname, const file_info& info)
         {
-            const auto& p = iter->path();
+            pool.submit([pathname = std::move(pathname), info]()
+                {
+                    file_output output;
 
-            // Don't throw if there is a Unicode pathname
-            const std::string pathname = reinterpret_cast<const char*>
-                (p.u8string().c_str());
+                    search_file(pathname, info, output);
 
-            if (!fs::is_directory(p) ||
-                g_options._directories == directories::read)
-            {
-                if (!process_file(pathname, *wcs))
-                    continue;
-            }
+                    std::scoped_lock lock(g_output_mutex);
+
+                    flush_output(output);
+                });
+        });
+}
 
-            if (fs::is_directory(p))
+// Directories are listed and files searched in parallel.
+// Output is grouped per file, in order of completion.
+static void process_unordered(thread_pool& pool)
+{
+    for (const auto& pathname : g_options._pathnames)
+    {
+        pool.submit([&pool, &pathname]()
             {
-                switch (g_options._directories)
+                list_dir_task(pool,
+                    { pathname.first, &pathname.second, nullptr });
+            });
+    }
+
+    pool.wait();
+}
+
+// A directory listing, read ahead of the serial walk
+struct dir_listing
+{
+    std::vector<dir_task> _dirs;
+    std::vector<std::pair<std::string, file_info>> _files;
+};
+
+// Directories are walked serially and files searched in parallel.
+// Output is released in the order of the serial walk.
+// The walk reads directories ahead on the pool, so that on deep trees
+// (and slow file systems) the metadata calls overlap rather than
+// queueing up one directory at a time.
+static void process_ordered(thread_pool& pool)
+{
+    std::size_t next = 0;
+    std::size_t seq = 0;
+    std::map<std::size_t, std::unique_ptr<file_output>> ready;
+    auto push_file = [&pool, &next, &seq, &ready](std::string&& pathname,
+        const file_info& info)
+        {
+            pool.submit([&next, &ready, seq, pathname = std::move(pathname),
+                info]()
                 {
-                case directories::read:
-                    if (!g_options._no_messages)
-                    {
-                        output_text_nl(std::cerr, is_a_tty(stderr),
-                            g_options._wa_text.c_str(),
-                            std::format("{}{}: Is a directory",
-                                gg_text(),
-                                normalise_pathname(p.string())));
-                    }
+                    auto output = std::make_unique<file_output>();
 
-                    break;
-                case directories::recurse:
-                    if (!(fs::is_symlink(p) && !g_options._follow_symlinks) &&
-                        include_dir(pathname.substr(pathname.
-                        rfind(fs::path::preferred_separator) + 1)))
+                    search_file(pathname, info, *output);
+
+                    std::scoped_lock lock(g_output_mutex);
+
+                    ready.emplace(seq, std::move(output));
+
+                    for (auto iter = ready.find(next); iter != ready.end();
+                        iter = ready.find(next))
                     {
-                        queue.emplace(pathname, wcs);
+                        flush_output(*iter->second);
+                        ready.erase(iter);
+                        ++next;
                     }
+                });
+            ++seq;
+        };
+    // Bounds the memory held by listings not yet walked
+    const std::size_t read_ahead = pool.size() * 2;
+    std::queue<dir_task> queue;
+    std::queue<std::future<dir_listing>> reading;
+    auto read_dirs = [&pool, &queue, &reading, read_ahead]()
+        {
+            for (; !queue.empty() && reading.size() < read_ahead; queue.pop())
+            {
+                auto task = std::make_shared<std::packaged_task<dir_listing()>>
+                    ([dir = std::move(queue.front())]()
+                    {
+                        dir_listing listing;
+
+                        list_dir(dir,
+                            [&listing](dir_task&& sub_dir)
+                            {
+                                listing._dirs.push_back(std::move(sub_dir));
+                            },
+                            [&listing](std::string&& pathname,
+                                const file_info& info)
+                            {
+                                listing._files.emplace_back
+                                    (std::move(pathname), info);
+                            });
+                        return listing;
+                    });
 
-                    break;
-                case directories::skip:
-                    // Do nothing
-                    break;
-                }
+                reading.push(task->get_future());
+                pool.submit([task]()
+                    {
+                        (*task)();
+                    });
             }
-            else
+        };
+
+    for (const auto& [path, wcs] : g_options._pathnames)
+    {
+        queue.push({ path, &wcs, nullptr });
+    }
+
+    try
+    {
+        for (read_dirs(); !reading.empty(); reading.pop(), read_dirs())
+        {
+            dir_listing listing = reading.front().get();
+
+            for (auto& dir : listing._dirs)
             {
-                if ((g_options._writable && (fs::status(p).permissions() &
-                    fs::perms::owner_write) == fs::perms::none) ||
-                    // Skip zero length files
-                    fs::file_size(p) == 0)
-                {
-                    continue;
-                }
+                queue.push(std::move(dir));
+            }
 
-                if (include_file(pathname.substr(pathname.
-                    rfind(fs::path::preferred_separator) + 1)))
-                {
-                    process_file(pathname);
-                    processed = true;
-                }
+            read_dirs();
+
+            for (auto& [pathname, info] : listing._files)
+            {
+                push_file(std::move(pathname), info);
             }
         }
+    }
+    catch (...)
+    {
+        // Tasks refer to locals, so let them finish first
+        pool.wait();
+        throw;
+    }
+
+    pool.wait();
+}
+
+static void process()
+{
+    const std::size_t threads = g_options._threads ?
+        g_options._threads :
+        std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+
+    if (threads == 1)
+        process_serial();
+    else
+    {
+        g_worker_contexts.assign(threads, search_context());
+
+        {
+            thread_pool pool(threads);
+
+            if (g_options._ordered)
+                process_ordered(pool);
+            else
+                process_unordered(pool);
+        }
 
-        if (!processed && g_options._directories != directories::recurse &&
-            !g_options._no_messages)
+        for (const auto& context : g_worker_contexts)
         {
-            for (const auto& wildcard : wcs->_positive)
-            {
-                if (!wildcard._pathname.empty())
-                {
-                    output_text_nl(std::cerr, is_a_tty(stderr),
-                        g_options._wa_text.c_str(),
-                        std::format("{}{}: No such file or directory",
-                            gg_text(),
-                            normalise_pathname(wildcard._pathname)));
-                }
-            }
+            g_context._files += context._files;
+            g_context._hits += context._hits;
+            g_context._searched += context._searched;
         }
     }
 }
@@ -1408,37 +1821,60 @@ static void add_pathname(std::string pn,
     }
 
     if (negate)
+    {
         // Not using emplace_back() for compatibility with Macintosh
         wcs._negative.push_back({ wildcardtl::wildcard{ pn, is_windows() },
             wc_idx == std::string::npos ?
             pn :
             std::string() });
+    }
     else
+    {
         // Not using emplace_back() for compatibility with Macintosh
         wcs._positive.push_back({ wildcardtl::wildcard{ pn, is_windows() },
             wc_idx == std::string::npos ?
             pn :
             std::string() });
+        wcs._positive_set.insert(pn);
+    }
 }
 
-lexertl::state_machine word_lexer()
+// Returns the number of configs from idx on that can share one lexer.
+// With --or, a run of flex patterns with the same flags are alternatives
+// of a single state machine (rule ids 1..n), so the data is scanned once
+// however many patterns there are.
+static std::size_t dfa_regex_run(const std::vector<config>& configs,
+    const std::size_t idx)
 {
-    static lexertl::state_machine sm;
+    // Use the lexertl enum operator
+    using namespace lexertl;
+    const config& first = configs[idx];
+    std::size_t count = 1;
 
-    if (sm.empty())
+    if (!g_options._or || !first._conditions.empty() ||
+        first._flags & *config_flags::negate)
     {
-        lexertl::rules rules;
+        return count;
+    }
+
+    for (std::size_t size = configs.size(); idx + count < size; ++count)
+    {
+        const config& cfg = configs[idx + count];
 
-        rules.push(R"([A-Z_a-z]\w*)", 1);
-        rules.push("(?s:.)", lexertl::rules::skip());
-        lexertl::generator::build(rules, sm);
+        if (cfg._type != match_type::dfa_regex ||
+            cfg._flags != first._flags || !cfg._conditions.empty())
+        {
+            break;
+        }
     }
 
-    return sm;
+    return count;
 }
 
-static void queue_dfa_regex(config& cfg)
+static void queue_dfa_regex(std::span<config> cfgs)
 {
+    config& cfg = cfgs.front();
+
     if (g_options._force_unicode)
     {
         // Use the lexertl enum operator
@@ -1447,6 +1883,7 @@ static void queue_dfa_regex(config& cfg)
         using ugenerator = basic_generator<rules_type, u32state_machine>;
         rules_type rules;
         ulexer lexer;
+        uint16_t id = 1;
 
         lexer._flags = cfg._flags;
         lexer._conditions = std::move(cfg._conditions);
@@ -1455,7 +1892,10 @@ static void queue_dfa_regex(config& cfg)
             rules.flags(*regex_flags::icase |
                 *regex_flags::dot_not_cr_lf);
 
-        rules.push(cfg._param, 1);
+        for (const auto& c : cfgs)
+        {
+            rules.push(c._param, id++);
+        }
 
         if (g_options._dump == dump::no)
         {
@@ -1472,6 +1912,7 @@ static void queue_dfa_regex(config& cfg)
         using namespace lexertl;
         rules rules;
         lexer lexer;
+        uint16_t id = 1;
 
         lexer._flags = cfg._flags;
         lexer._conditions = std::move(cfg._conditions);
@@ -1480,12 +1921,16 @@ static void queue_dfa_regex(config& cfg)
             rules.flags(*regex_flags::icase |
                 *regex_flags::dot_not_cr_lf);
 
-        rules.push(cfg._param, 1);
+        for (const auto& c : cfgs)
+        {
+            rules.push(c._param, id++);
+        }
 
         if (g_options._dump == dump::no)
             rules.push("(?s:.)", rules::skip());
 
         generator::build(rules, lexer._sm);
+        lexer._scanner = start_scanner(lexer._sm, false);
         g_pipeline.emplace_back(std::move(lexer));
     }
 }
@@ -1541,10 +1986,14 @@ static void queue_parser(config& cfg)
             lexer._flags = parser._flags;
             lexer._conditions = std::move(parser._conditions);
             lexer._sm.swap(parser._lsm);
+            lexer._scanner = start_scanner(lexer._sm, false);
             g_pipeline.emplace_back(std::move(lexer));
         }
         else
+        {
+            parser._scanner = start_scanner(parser._lsm, true);
             g_pipeline.emplace_back(std::move(parser));
+        }
     }
 }
 
@@ -1569,25 +2018,62 @@ static void queue_regex(config& cfg)
         rx_flags |= boost::regex_constants::ECMAScript;
 
     regex._rx.assign(cfg._param, rx_flags);
+
+    // POSIX regexes without back references or anchors give the same
+    // (leftmost longest) matches as a DFA, which does not backtrack.
+    if (std::string dfa_rx;
+        regex._flags & (*config_flags::grep | *config_flags::egrep) &&
+        posix_to_lexertl(cfg._param,
+            (regex._flags & *config_flags::egrep) != 0, dfa_rx))
+    {
+        try
+        {
+            rules rules;
+
+            if (regex._flags & *config_flags::icase)
+                rules.flags(*regex_flags::icase);
+
+            rules.push(dfa_rx, 1);
+            rules.push("(?s:.)", rules::skip());
+            generator::build(rules, regex._sm);
+            regex._scanner = start_scanner(regex._sm, false);
+        }
+        catch (const std::exception&)
+        {
+            // Fall back to boost
+            regex._sm.clear();
+        }
+    }
+
     g_pipeline.emplace_back(std::move(regex));
 }
 
 static void queue_text(config& cfg)
 {
+    // Use the lexertl enum operator
+    using namespace lexertl;
     text text;
 
     text._flags = cfg._flags;
     text._conditions = std::move(cfg._conditions);
     text._text = cfg._param;
+
+    if (!boost::regex_search(text._text, g_capture_rx))
+        text._scanner.emplace(text._text,
+            (text._flags & *config_flags::icase) != 0);
+
     g_pipeline.emplace_back(std::move(text));
 }
 
 static void queue_word_list(config& cfg, std::size_t& word_list_idx)
 {
+    // Use the lexertl enum operator
+    using namespace lexertl;
     word_list words;
+    const bool icase = (cfg._flags & *config_flags::icase) != 0;
     lexertl::memory_file& mf =
         g_options._word_list_files[word_list_idx];
-    const lexertl::state_machine sm = word_lexer();
+    const lexertl::state_machine& sm = word_lexer();
     lexertl::citerator iter;
 
     ++word_list_idx;
@@ -1600,31 +2086,105 @@ static void queue_word_list(config& cfg, std::size_t& word_list_idx)
 
     iter = lexertl::citerator(mf.data(), mf.data() + mf.size(), sm);
 
+    words._words = decltype(words._words)(0, word_hash{ icase },
+        word_equal{ icase });
+
     for (; iter->id != 0; ++iter)
     {
-        words._list.push_back(iter->view());
+        words._words.insert(iter->view());
     }
 
-    std::ranges::sort(words._list);
     g_pipeline.emplace_back(std::move(words));
 }
 
+// Tells the index (--use-index) what any match of cfg must contain
+static void require_literals(const config& cfg)
+{
+    // Use the lexertl enum operator
+    using namespace lexertl;
+    bool icase = (cfg._flags & *config_flags::icase) != 0;
+
+    if (cfg._flags & *config_flags::negate)
+        return;
+
+    switch (cfg._type)
+    {
+    case match_type::text:
+        if (!boost::regex_search(cfg._param, g_capture_rx))
+            g_index.require(cfg._param, icase);
+
+        break;
+    case match_type::regex:
+    case match_type::dfa_regex:
+    {
+        const regex_syntax syntax = cfg._type == match_type::dfa_regex ?
+            regex_syntax::lexertl :
+            cfg._flags & *config_flags::grep ?
+            regex_syntax::basic :
+            cfg._flags & *config_flags::egrep ?
+            regex_syntax::extended :
+            regex_syntax::ecmascript;
+        bool inline_flags = false;
+
+        for (const auto& literal :
+            required_literals(cfg._param, syntax, inline_flags))
+        {
+            g_index.require(literal, icase || inline_flags);
+        }
+
+        break;
+    }
+    default:
+        // Nothing is extracted from grammars or word lists
+        break;
+    }
+}
+
+// Stages after a grammar with actions search the strings the actions
+// return rather than the file.
+static bool rewrites_input(const pipeline::value_type& stage)
+{
+    if (const auto* p = std::get_if<parser>(&stage))
+        return !p->_actions.empty();
+    else if (const auto* p = std::get_if<uparser>(&stage))
+        return !p->_actions.empty();
+    else
+        return false;
+}
+
 static void fill_pipeline(std::vector<config>&& configs)
 {
     std::size_t word_list_idx = 0;
+    // Files that cannot match are still listed by -L and -c
+    bool use_index = !g_options._use_index.empty() &&
+        g_options._pathname_only != pathname_only::negated &&
+        !g_options._show_count;
 
     // Postponed to allow -i to be processed first.
-    for (auto&& cfg : std::move(configs))
+    for (std::size_t idx = 0, size = configs.size(); idx < size; ++idx)
     {
         using enum match_type;
+        config& cfg = configs[idx];
+        const std::size_t count = cfg._type == dfa_regex ?
+            dfa_regex_run(configs, idx) :
+            1;
+
+        // Alternatives are not individually required
+        if (use_index && count == 1)
+            require_literals(cfg);
 
         switch (cfg._type)
         {
         case dfa_regex:
-            queue_dfa_regex(cfg);
+            queue_dfa_regex(std::span(configs).subspan(idx, count));
+            idx += count - 1;
             break;
         case parser:
             queue_parser(cfg);
+
+            if (rewrites_input(g_pipeline.back()))
+                use_index = false;
+
             break;
         case regex:
             queue_regex(cfg);
@@ -1844,6 +2404,7 @@ int main(int argc, char* argv[])
             &options.front(), configs, files);
         parse_colours(env_var("GREP_COLORS"));
         read_switches(argc, argv, configs, files);
+        buffer_output();
 
         if (!g_options._print_script.empty() ||
             !g_options._replace_script.empty())
@@ -1851,6 +2412,13 @@ int main(int argc, char* argv[])
             build_ret_parser();
         }
 
+        // Compile scripts once, rather than per match
+        if (!g_options._print_script.empty())
+            g_print_script = parse_ret(g_options._print_script)._actions;
+
+        if (!g_options._replace_script.empty())
+            g_replace_script = parse_ret(g_options._replace_script)._actions;
+
         fill_pipeline(std::move(configs));
 
         // Postponed to allow -r to be processed first as
@@ -1868,6 +2436,15 @@ int main(int argc, char* argv[])
             }
         }
 
+        g_options._include.build();
+        g_options._exclude.build();
+        g_options._exclude_dirs.build();
+
+        for (auto& [path, wcs] : g_options._pathnames)
+        {
+            wcs.build();
+        }
+
         if (g_options._show_filename == show_filename::undefined &&
             g_options._pathnames.size() == 1)
         {
@@ -1932,6 +2509,12 @@ int main(int argc, char* argv[])
         if (g_options._perform_output && g_options._pathnames.empty())
             throw gg_error("Cannot combine stdin with -o.");
 
+        if (g_options._perform_output && g_options._stream)
+            throw gg_error("Cannot combine --stream with --perform-output.");
+
+        if (!g_options._build_index.empty() && g_options._stream)
+            throw gg_error("Cannot combine --stream with --build-index.");
+
         if (!g_options._replace.empty() && g_options._modify)
             throw gg_error("Cannot combine --replace with grammar "
                 "actions that modify the input.");
@@ -1955,12 +2538,25 @@ int main(int argc, char* argv[])
             {
                 std::string cin;
 
-                process_file(std::string(), &cin);
+                process_file(std::string(), file_info(), &cin);
             }
             else
+            {
+                if (!g_options._use_index.empty())
+                    g_index.load(g_options._use_index);
+                else if (!g_options._build_index.empty())
+                    g_index.load(g_options._build_index);
+
                 process();
+
+                if (!g_options._build_index.empty())
+                    g_index.save(g_options._build_index);
+            }
         }
 
+        // Keep any output from the command after our own
+        std::cout << std::flush;
+
         if (!g_options._shutdown.empty())
             if (::system(g_options._shutdown.c_str()))
             {
@@ -1974,12 +2570,13 @@ int main(int argc, char* argv[])
 
         if (g_options._summary)
         {
-            std::cout << "Matches: " << g_hits << "    Matching files: " <<
-                g_files << "    Total files searched: " << g_searched <<
+            std::cout << "Matches: " << g_context._hits <<
+                "    Matching files: " << g_context._files <<
+                "    Total files searched: " << g_context._searched <<
                 output_nl;
         }
 
-        return g_hits ? 0 : 1;
+        return g_context._hits ? 0 : 1;
     }
     catch (const std::exception& e)
     {
@@ -0,0 +1,173 @@
+#include "pch.h"
+
+#include "multi_start.hpp"
+
+#include <parsertl/enums.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <memory_resource>
+
+void multi_start_parser::attempt::push(const id_type state)
+{
+    const std::size_t hash = _hashes.empty() ? 0 : _hashes.back();
+
+    _stack.push_back(state);
+    _hashes.push_back(hash * 0x9e3779b97f4a7c15ULL + state + 1);
+}
+
+void multi_start_parser::attempt::pop(const std::size_t count)
+{
+    _stack.resize(_stack.size() - count);
+    _hashes.resize(_hashes.size() - count);
+}
+
+multi_start_parser::multi_start_parser(const parsertl::state_machine& sm,
+    std::pmr::memory_resource* resource) :
+    _sm(sm),
+    _attempts(resource),
+    _overlay(resource),
+    _seen(resource)
+{
+}
+
+bool multi_start_parser::push(const std::size_t id)
+{
+    // Nothing starting after an attempt that has accepted can be first
+    if (id != 0 && (_attempts.empty() || !_attempts.back()._hit))
+    {
+        _attempts.emplace_back(_attempts.get_allocator().resource())._start =
+            _index;
+        _attempts.back().push(0);
+    }
+
+    for (attempt& a : _attempts)
+    {
+        if (a._dead)
+            continue;
+
+        // Acceptance has already been checked after every shift
+        if (id == 0)
+            a._dead = true;
+        else if (step(a, id))
+            a._hit |= accepts(a);
+        else
+            a._dead = true;
+    }
+
+    merge();
+    std::erase_if(_attempts, [](const attempt& a)
+        {
+            return a._dead && !a._hit;
+        });
+
+    if (auto iter = std::ranges::find_if(_attempts, &attempt::_hit);
+        iter != _attempts.end())
+    {
+        _attempts.erase(iter + 1, _attempts.end());
+    }
+
+    ++_index;
+    // The first attempt has accepted and every earlier one has failed
+    return !_attempts.empty() && _attempts.front()._hit;
+}
+
+// Shifts id, performing any reductions first.
+// Returns false on a parse error.
+bool multi_start_parser::step(attempt& a, const std::size_t id)
+{
+    // Unknown token (npos from the lexer)
+    if (id >= _sm._columns)
+        return false;
+
+    for (;;)
+    {
+        const auto entry = _sm.at(a._stack.back(), id);
+
+        switch (entry.action)
+        {
+        case parsertl::action::shift:
+            a.push(entry.param);
+            return true;
+        case parsertl::action::reduce:
+        {
+            const auto& rule = _sm._rules[entry.param];
+
+            a.pop(rule._rhs.size());
+            a.push(_sm.at(a._stack.back(), rule._lhs).param);
+            break;
+        }
+        default:
+            // Accept only occurs at the end of input
+            return false;
+        }
+    }
+}
+
+// True if the tokens shifted so far are a complete match.
+// The reductions for the end of input are made on _overlay, leaving
+// a._stack untouched.
+bool multi_start_parser::accepts(const attempt& a)
+{
+    std::size_t depth = a._stack.size();
+
+    _overlay.clear();
+
+    for (;;)
+    {
+        const id_type state = _overlay.empty() ?
+            a._stack[depth - 1] :
+            _overlay.back();
+        const auto entry = _sm.at(state, 0);
+
+        switch (entry.action)
+        {
+        case parsertl::action::accept:
+            return true;
+        case parsertl::action::reduce:
+        {
+            const auto& rule = _sm._rules[entry.param];
+            const std::size_t count = rule._rhs.size();
+            const std::size_t overlaid = std::min(count, _overlay.size());
+
+            _overlay.resize(_overlay.size() - overlaid);
+            depth -= count - overlaid;
+            _overlay.push_back(_sm.at(_overlay.empty() ?
+                a._stack[depth - 1] :
+                _overlay.back(), rule._lhs).param);
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+}
+
+// Drops live attempts with the same stack as an earlier one.
+// Later attempts that have already accepted are kept, as they may still
+// be the first match if the earlier attempt fails.
+void multi_start_parser::merge()
+{
+    _seen.clear();
+
+    for (std::size_t idx = 0, size = _attempts.size(); idx < size; ++idx)
+    {
+        if (!_attempts[idx]._dead)
+            _seen.emplace_back(_attempts[idx]._hashes.back(), idx);
+    }
+
+    // Equal hashes are adjacent and in order of _start
+    std::ranges::sort(_seen);
+
+    for (std::size_t idx = 1, size = _seen.size(); idx < size; ++idx)
+    {
+        if (_seen[idx].first != _seen[idx - 1].first)
+            continue;
+
+        const attempt& prev = _attempts[_seen[idx - 1].second];
+        attempt& curr = _attempts[_seen[idx].second];
+
+        if (!curr._hit && curr._stack == prev._stack)
+            curr._dead = true;
+    }
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <parsertl/state_machine.hpp>
+
+#include <cstddef>
+#include <memory_resource>
+#include <utility>
+
+// Finds where the first match of a grammar starts in a single pass over
+// the tokens (--single-pass).
+// parsertl::search tries a parse from each token in turn, so a long
+// failed attempt is repeated from every token it covered. Here a parse
+// attempt is started at every token and all of the live attempts are
+// advanced together. The tables are LALR, so two attempts with the same
+// stack have the same future: the later one is dropped, which keeps the
+// number of live attempts small.
+class multi_start_parser
+{
+public:
+    using id_type = parsertl::state_machine::id_type;
+
+    // Working storage is allocated from resource.
+    multi_start_parser(const parsertl::state_machine& sm,
+        std::pmr::memory_resource* resource);
+
+    // Advances every attempt by the next token (id 0 being the end of
+    // input). Returns true once start() is known to be the first match.
+    bool push(const std::size_t id);
+
+    // The index of the token that the first match starts at.
+    std::size_t start() const
+    {
+        return _attempts.front()._start;
+    }
+
+private:
+    struct attempt
+    {
+        std::size_t _start = 0;
+        // An accepting parse has been seen
+        bool _hit = false;
+        // The attempt has hit an error (only kept if _hit is set)
+        bool _dead = false;
+        std::pmr::vector<id_type> _stack;
+        // _hashes[n] is a hash of _stack[0..n]
+        std::pmr::vector<std::size_t> _hashes;
+
+        explicit attempt(std::pmr::memory_resource* resource) :
+            _stack(resource),
+            _hashes(resource)
+        {
+        }
+
+        void push(const id_type state);
+        void pop(const std::size_t count);
+    };
+
+    const parsertl::state_machine& _sm;
+    // Tokens pushed so far
+    std::size_t _index = 0;
+    // In order of _start
+    std::pmr::vector<attempt> _attempts;
+    // Scratch space
+    std::pmr::vector<id_type> _overlay;
+    std::pmr::vector<std::pair<std::size_t, std::size_t>> _seen;
+
+    bool step(attempt& a, const std::size_t id);
+    bool accepts(const attempt& a);
+    void merge();
+};
+
+// Moves iter to the first token that a match of sm starts at (or to the
+// end of input, returning false). parsertl::search called from there
+// succeeds straight away and supplies the productions and captures.
+template<typename iterator>
+bool find_match_start(iterator& iter, const parsertl::state_machine& sm,
+    std::pmr::memory_resource* resource)
+{
+    multi_start_parser parser(sm, resource);
+
+    for (iterator curr = iter;; ++curr)
+    {
+        const std::size_t id = curr->id;
+
+        if (parser.push(id))
+        {
+            // Moving iter on again is cheap compared with the parsing
+            for (std::size_t idx = parser.start(); idx; --idx)
+            {
+                ++iter;
+            }
+
+            return true;
+        }
+
+        if (id == 0)
+        {
+            iter = curr;
+            return false;
+        }
+    }
+}
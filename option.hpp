@@ -108,6 +108,39 @@ void validate_value(int& i, const char* const argv[],
     }
 }
 
+// Parses a byte count with an optional K or M suffix
+std::size_t parse_size(const std::string_view& value,
+    const std::string_view& name)
+{
+    const char* last = value.data() + value.size();
+    std::size_t size = 0;
+    auto [ptr, ec] = std::from_chars(value.data(), last, size);
+
+    if (ec == std::errc() && ptr + 1 == last)
+    {
+        switch (*ptr)
+        {
+        case 'K':
+        case 'k':
+            size *= 1024;
+            ++ptr;
+            break;
+        case 'M':
+        case 'm':
+            size *= 1024 * 1024;
+            ++ptr;
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (ec != std::errc() || ptr != last)
+        throw gg_error(std::format("Invalid {} '{}'", name, value));
+
+    return size;
+}
+
 void add_pathname(const char* first, const char* second, wildcards& wcs)
 {
     const std::string pathname(*first == '!' ? first + 1 : first, second);
@@ -122,6 +155,7 @@ void add_pathname(const char* first, const char* second, wildcards& wcs)
             pathname.find_first_of("*?[") == std::string::npos ?
             pathname :
             std::string() });
+        wcs._negative_set.insert(pathname);
     }
     else
     {
@@ -133,6 +167,7 @@ void add_pathname(const char* first, const char* second, wildcards& wcs)
             pathname.find_first_of("*?[") == std::string::npos ?
             pathname :
             std::string() });
+        wcs._positive_set.insert(pathname);
     }
 }
 
@@ -703,6 +738,7 @@ const option g_option[]
                         pathname.find_first_of("*?[") == std::string::npos ?
                         pathname :
                         std::string() });
+                    g_options._exclude_dirs._negative_set.insert(pathname);
                 }
                 else
                 {
@@ -716,6 +752,7 @@ const option g_option[]
                         pathname.find_first_of("*?[") == std::string::npos ?
                         pathname :
                         std::string() });
+                    g_options._exclude_dirs._positive_set.insert(pathname);
                 }
             }
         }
@@ -879,6 +916,44 @@ const option g_option[]
         "WHEN is 'always', 'never', or 'auto'",
         colour
     },
+    {
+        option::type::gram_grep,
+        '\0',
+        "binary-probe",
+        "SIZE",
+        "check the first SIZE bytes of a file for binary content\n"
+        "(default 32K, 0 for the whole file); a NUL past SIZE\n"
+        "no longer makes a file binary",
+        [](int&, const bool, const char* const [],
+            std::string_view value, std::vector<config>&)
+        {
+            g_options._binary_probe = parse_size(value, "probe size");
+        }
+    },
+    {
+        option::type::gram_grep,
+        '\0',
+        "build-index",
+        "FILE",
+        "record the trigrams of the files searched in FILE",
+        [](int&, const bool, const char* const [],
+            std::string_view value, std::vector<config>&)
+        {
+            g_options._build_index = value;
+        }
+    },
+    {
+        option::type::gram_grep,
+        '\0',
+        "cache-dir",
+        "DIR",
+        "cache the state machines built from config files in DIR",
+        [](int&, const bool, const char* const [],
+            std::string_view value, std::vector<config>&)
+        {
+            g_options._cache_dir = value;
+        }
+    },
     {
         option::type::gram_grep,
         '\0',
@@ -1019,6 +1094,18 @@ const option g_option[]
             g_options._force_write = true;
         }
     },
+    {
+        option::type::gram_grep,
+        '\0',
+        "gitignore",
+        nullptr,
+        "skip files and directories listed in .gitignore or .ignore files",
+        [](int&, const bool, const char* const [], std::string_view,
+            std::vector<config>&)
+        {
+            g_options._gitignore = true;
+        }
+    },
     {
         option::type::gram_grep,
         '\0',
@@ -1060,6 +1147,30 @@ const option g_option[]
             g_options._line_numbers = line_numbers::with_parens;
         }
     },
+    {
+        option::type::gram_grep,
+        '\0',
+        "or",
+        nullptr,
+        "match any of consecutive --flex-regexp patterns in one pass",
+        [](int&, const bool, const char* const [],
+            std::string_view, std::vector<config>&)
+        {
+            g_options._or = true;
+        }
+    },
+    {
+        option::type::gram_grep,
+        '\0',
+        "ordered",
+        nullptr,
+        "with --threads, output files in directory walk order",
+        [](int&, const bool, const char* const [],
+            std::string_view, std::vector<config>&)
+        {
+            g_options._ordered = true;
+        }
+    },
     {
         option::type::gram_grep,
         '\0',
@@ -1163,6 +1274,22 @@ const option g_option[]
             g_options._shutdown = value;
         }
     },
+    {
+        option::type::gram_grep,
+        '\0',
+        "single-pass",
+        nullptr,
+        "find grammar matches in a single pass over the tokens\n"
+        "(ignored with --utf8)",
+        [](int&, const bool, const char* const [], std::string_view,
+            std::vector<config>&)
+        {
+            // Use the lexertl enum operator
+            using namespace lexertl;
+
+            g_options._flags |= *config_flags::single_pass;
+        }
+    },
     {
         option::type::gram_grep,
         '\0',
@@ -1178,6 +1305,23 @@ const option g_option[]
             g_options._startup = value;
         }
     },
+    {
+        option::type::gram_grep,
+        '\0',
+        "stream",
+        "[SIZE]",
+        "search input in windows of SIZE bytes (default 1M)",
+        [](int&, const bool, const char* const [],
+            std::string_view value, std::vector<config>&)
+        {
+            g_options._stream = value.empty() ?
+                1024 * 1024 :
+                parse_size(value, "stream size");
+
+            if (g_options._stream == 0)
+                throw gg_error(std::format("Invalid stream size '{}'", value));
+        }
+    },
     {
         option::type::gram_grep,
         '\0',
@@ -1190,6 +1334,36 @@ const option g_option[]
             g_options._summary = true;
         }
     },
+    {
+        option::type::gram_grep,
+        'j',
+        "threads",
+        "NUM",
+        "search files using NUM threads (0 for one per core)",
+        [](int& i, const bool longp, const char* const argv[],
+            std::string_view value, std::vector<config>&)
+        {
+            validate_value(i, argv, longp, value);
+
+            if (std::from_chars(value.data(), value.data() + value.size(),
+                g_options._threads).ec != std::errc())
+            {
+                throw gg_error(std::format("Invalid thread count '{}'", value));
+            }
+        }
+    },
+    {
+        option::type::gram_grep,
+        '\0',
+        "use-index",
+        "FILE",
+        "skip files that FILE shows cannot match",
+        [](int&, const bool, const char* const [],
+            std::string_view value, std::vector<config>&)
+        {
+            g_options._use_index = value;
+        }
+    },
     {
         option::type::gram_grep,
         '\0',
@@ -1,6 +1,14 @@
 #include "pch.h"
 
+#include "output.hpp"
+
+#include <cerrno>
+#include <cstddef>
 #include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <streambuf>
+#include <vector>
 
 #if _WIN32
 #include <io.h>
@@ -8,12 +16,106 @@
 #include <unistd.h>
 #endif
 
+class output_buffer : public std::streambuf
+{
+public:
+    output_buffer() :
+        _buffer(64 * 1024),
+        _prev(std::cout.rdbuf(this))
+    {
+        setp(_buffer.data(), _buffer.data() + _buffer.size());
+    }
+
+    ~output_buffer() override
+    {
+        flush();
+        std::cout.rdbuf(_prev);
+    }
+
+protected:
+    int_type overflow(int_type c) override
+    {
+        if (!flush())
+            return traits_type::eof();
+
+        if (!traits_type::eq_int_type(c, traits_type::eof()))
+        {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize n) override
+    {
+        if (n > epptr() - pptr())
+        {
+            if (!flush())
+                return 0;
+
+            // Too big to buffer, so write it straight out
+            if (n > epptr() - pptr())
+                return write(s, static_cast<std::size_t>(n)) ? n : 0;
+        }
+
+        std::memcpy(pptr(), s, static_cast<std::size_t>(n));
+        pbump(static_cast<int>(n));
+        return n;
+    }
+
+    int sync() override
+    {
+        return flush() ? 0 : -1;
+    }
+
+private:
+    std::vector<char> _buffer;
+    std::streambuf* _prev = nullptr;
+
+    bool flush()
+    {
+        const bool ok = write(pbase(), pptr() - pbase());
+
+        setp(_buffer.data(), _buffer.data() + _buffer.size());
+        return ok;
+    }
+
+    static bool write(const char* data, std::size_t size)
+    {
+        while (size)
+        {
+#ifdef _WIN32
+            const int written = _write(1, data,
+                static_cast<unsigned int>(size));
+#else
+            const auto written = ::write(1, data, size);
+#endif
+
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                return false;
+            }
+
+            data += written;
+            size -= static_cast<std::size_t>(written);
+        }
+
+        return true;
+    }
+};
+
+static thread_local std::ostream* t_output = nullptr;
+
 const char* gg_text()
 {
     return "gram_grep: ";
 }
 
-bool is_a_tty(FILE* fd)
+static bool query_tty(FILE* fd)
 {
 #ifdef _WIN32
     return _isatty(_fileno(fd));
@@ -21,3 +123,33 @@ bool is_a_tty(FILE* fd)
     return isatty(fileno(fd));
 #endif
 }
+
+bool is_a_tty(FILE* fd)
+{
+    // Thread safe initialisation
+    static const bool out = query_tty(stdout);
+    static const bool err = query_tty(stderr);
+
+    if (fd == stdout)
+        return out;
+    else if (fd == stderr)
+        return err;
+    else
+        return query_tty(fd);
+}
+
+void buffer_output()
+{
+    // Constructed after std::cout, so destroyed (and flushed) before it
+    static output_buffer buffer;
+}
+
+std::ostream& output_stream()
+{
+    return t_output ? *t_output : std::cout;
+}
+
+void set_output_stream(std::ostream* os)
+{
+    t_output = os;
+}
@@ -10,8 +10,19 @@
 
 extern options g_options;
 
+// The answer for stdout and stderr is cached after the first call.
 bool is_a_tty(FILE* fd);
 
+// Puts a large buffer in front of std::cout that is written to stdout
+// with a single write() when full or flushed (see --line-buffered).
+// Call before searching; the buffer is flushed at exit.
+void buffer_output();
+
+// Destination for search results on the calling thread.
+// Defaults to std::cout; worker threads redirect it to a per file buffer.
+std::ostream& output_stream();
+void set_output_stream(std::ostream* os);
+
 const char* gg_text();
 
 template<class CharT, class Traits>
@@ -1123,53 +1123,89 @@ void build_ret_parser()
     lexertl::generator::build(lrules, g_ret_parser._lsm);
 }
 
-std::pair<parsertl::state_machine, lexertl::state_machine> param_parser()
+const lexertl::state_machine& capture_lexer()
 {
-    static parsertl::state_machine gsm;
-    static lexertl::state_machine lsm;
+    // Thread safe initialisation
+    static const lexertl::state_machine sm = []()
+        {
+            lexertl::rules rules;
+            lexertl::state_machine lsm;
 
-    if (gsm.empty())
-    {
-        parsertl::rules grules(*parsertl::rule_flags::enable_captures);
-        lexertl::rules lrules;
-
-        grules.token("ANY TYPE UINT");
-        grules.push("format_spec", "'{' opt_colon options width_and_precision [type] '}'");
-        grules.push("opt_colon", "%empty | ':'");
-        grules.push("options", "[fill] [align] [sign] ['z'] ['#'] ['0']");
-        grules.push("fill", "ANY");
-        grules.push("align", "'<' | '>' | '=' | '^'");
-        grules.push("sign", "'+' | '-' | ' '");
-        grules.push("width_and_precision", "width_with_grouping [precision_with_grouping]");
-        grules.push("width_with_grouping", "[width] [grouping]");
-        grules.push("precision_with_grouping", "'.' [precision] [grouping]");
-        grules.push("width", "UINT");
-        grules.push("precision", "UINT");
-        grules.push("grouping", "',' | '_'");
-        grules.push("type", "(TYPE)");
-        parsertl::generator::build(grules, gsm);
-
-        lrules.push("z", grules.token_id("'z'"));
-        lrules.push("#", grules.token_id("'#'"));
-        lrules.push("0", grules.token_id("'0'"));
-        lrules.push("<", grules.token_id("'<'"));
-        lrules.push(">", grules.token_id("'>'"));
-        lrules.push("=", grules.token_id("'='"));
-        lrules.push(R"(\^)", grules.token_id("'^'"));
-        lrules.push(R"(\+)", grules.token_id("'+'"));
-        lrules.push("-", grules.token_id("'-'"));
-        lrules.push(" ", grules.token_id("' '"));
-        lrules.push(",", grules.token_id("','"));
-        lrules.push("_", grules.token_id("'_'"));
-        lrules.push(":", grules.token_id("':'"));
-        lrules.push(R"(\{)", grules.token_id("'{'"));
-        lrules.push(R"(\})", grules.token_id("'}'"));
-        lrules.push(R"(\.)", grules.token_id("'.'"));
-        lrules.push("[aAbBdeEfFgGoxX]", grules.token_id("TYPE"));
-        lrules.push(R"(\d+)", grules.token_id("UINT"));
-        lrules.push(".", grules.token_id("ANY"));
-        lexertl::generator::build(lrules, lsm);
-    }
+            rules.push(R"(\$\d)", 1);
+            lexertl::generator::build(rules, lsm);
+            return lsm;
+        }();
+
+    return sm;
+}
+
+const std::pair<parsertl::state_machine, lexertl::state_machine>&
+    param_parser()
+{
+    // Thread safe initialisation
+    static const std::pair<parsertl::state_machine, lexertl::state_machine>
+        machines = []()
+        {
+            parsertl::rules grules(*parsertl::rule_flags::enable_captures);
+            lexertl::rules lrules;
+            parsertl::state_machine gsm;
+            lexertl::state_machine lsm;
+
+            grules.token("ANY TYPE UINT");
+            grules.push("format_spec", "'{' opt_colon options width_and_precision [type] '}'");
+            grules.push("opt_colon", "%empty | ':'");
+            grules.push("options", "[fill] [align] [sign] ['z'] ['#'] ['0']");
+            grules.push("fill", "ANY");
+            grules.push("align", "'<' | '>' | '=' | '^'");
+            grules.push("sign", "'+' | '-' | ' '");
+            grules.push("width_and_precision", "width_with_grouping [precision_with_grouping]");
+            grules.push("width_with_grouping", "[width] [grouping]");
+            grules.push("precision_with_grouping", "'.' [precision] [grouping]");
+            grules.push("width", "UINT");
+            grules.push("precision", "UINT");
+            grules.push("grouping", "',' | '_'");
+            grules.push("type", "(TYPE)");
+            parsertl::generator::build(grules, gsm);
+
+            lrules.push("z", grules.token_id("'z'"));
+            lrules.push("#", grules.token_id("'#'"));
+            lrules.push("0", grules.token_id("'0'"));
+            lrules.push("<", grules.token_id("'<'"));
+            lrules.push(">", grules.token_id("'>'"));
+            lrules.push("=", grules.token_id("'='"));
+            lrules.push(R"(\^)", grules.token_id("'^'"));
+            lrules.push(R"(\+)", grules.token_id("'+'"));
+            lrules.push("-", grules.token_id("'-'"));
+            lrules.push(" ", grules.token_id("' '"));
+            lrules.push(",", grules.token_id("','"));
+            lrules.push("_", grules.token_id("'_'"));
+            lrules.push(":", grules.token_id("':'"));
+            lrules.push(R"(\{)", grules.token_id("'{'"));
+            lrules.push(R"(\})", grules.token_id("'}'"));
+            lrules.push(R"(\.)", grules.token_id("'.'"));
+            lrules.push("[aAbBdeEfFgGoxX]", grules.token_id("TYPE"));
+            lrules.push(R"(\d+)", grules.token_id("UINT"));
+            lrules.push(".", grules.token_id("ANY"));
+            lexertl::generator::build(lrules, lsm);
+            return std::make_pair(gsm, lsm);
+        }();
+
+    return machines;
+}
+
+const lexertl::state_machine& word_lexer()
+{
+    // Thread safe initialisation
+    static const lexertl::state_machine sm = []()
+        {
+            lexertl::rules rules;
+            lexertl::state_machine lsm;
+
+            rules.push(R"([A-Z_a-z]\w*)", 1);
+            rules.push("(?s:.)", lexertl::rules::skip());
+            lexertl::generator::build(rules, lsm);
+            return lsm;
+        }();
 
-    return std::make_pair(gsm, lsm);
+    return sm;
 }
@@ -12,7 +12,11 @@
 void build_condition_parser();
 void build_config_parser();
 void build_ret_parser();
-std::pair<parsertl::state_machine, lexertl::state_machine> param_parser();
+// The following are built on first use and shared thereafter
+const lexertl::state_machine& capture_lexer();
+const std::pair<parsertl::state_machine, lexertl::state_machine>&
+    param_parser();
+const lexertl::state_machine& word_lexer();
 
 template<typename PARSER>
 void push_ret_functions(parsertl::rules& grules, PARSER& parser)
@@ -0,0 +1,426 @@
+#include "pch.h"
+
+#include "glob_set.hpp"
+#include "posix_regex.hpp"
+
+#include <cctype>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// Larger counted repeats are left to boost rather than grow the DFA
+static constexpr std::size_t g_max_repeat = 255;
+
+struct posix_converter
+{
+    std::string_view _rx;
+    bool _extended = false;
+    // Extended syntax, with ECMAScript's '.' and bracket expressions
+    bool _ecmascript = false;
+    std::size_t _idx = 0;
+    std::string _out;
+
+    // Parses up to the end of the current group (or the regex).
+    // nullable is set if the alternation can match the empty string.
+    bool alternation(const bool top, bool& nullable);
+
+private:
+    bool sequence(const bool top, bool& nullable);
+    bool atom(bool& nullable);
+    bool group(bool& nullable);
+    bool bracket();
+    bool char_class();
+    bool quantifier(bool& nullable);
+    bool interval(bool& nullable);
+    bool at(const char c, const std::size_t offset = 0) const;
+};
+
+static bool supported(const char c)
+{
+    const auto uc = static_cast<unsigned char>(c);
+
+    // Bytes outside printable ASCII are left to boost
+    return uc >= 0x20 && uc < 0x7f;
+}
+
+bool posix_converter::at(const char c, const std::size_t offset) const
+{
+    return _idx + offset < _rx.size() && _rx[_idx + offset] == c;
+}
+
+bool posix_converter::alternation(const bool top, bool& nullable)
+{
+    nullable = false;
+
+    for (;;)
+    {
+        bool seq_nullable = false;
+
+        if (!sequence(top, seq_nullable))
+            return false;
+
+        nullable |= seq_nullable;
+
+        // A newline separates alternatives (grep -e "a<newline>b")
+        if ((top && !_ecmascript && at('\n')) || (_extended && at('|')))
+        {
+            _out += '|';
+            ++_idx;
+        }
+        else
+            return true;
+    }
+}
+
+bool posix_converter::sequence(const bool top, bool& nullable)
+{
+    std::size_t items = 0;
+
+    nullable = true;
+
+    while (_idx < _rx.size())
+    {
+        if (at('\n'))
+        {
+            if (top)
+                break;
+
+            return false;
+        }
+
+        if (_extended ? at('|') || at(')') : at('\\') && at(')', 1))
+            break;
+
+        bool item_nullable = false;
+
+        if (!atom(item_nullable) || !quantifier(item_nullable))
+            return false;
+
+        nullable &= item_nullable;
+        ++items;
+    }
+
+    // Empty alternatives and groups are left to boost
+    return items != 0;
+}
+
+bool posix_converter::atom(bool& nullable)
+{
+    const char c = _rx[_idx];
+
+    nullable = false;
+
+    switch (c)
+    {
+    case '.':
+        // As boost with match_not_dot_newline (and without, for
+        // ECMAScript conditions)
+        _out += _ecmascript ? "(?s:.)" : "[^\\n\\f\\r]";
+        ++_idx;
+        return true;
+    case '[':
+        return bracket();
+    case '^':
+    case '$':
+    case '*':
+        // Anchors and repeats of nothing
+        return false;
+    case '\\':
+    {
+        if (_idx + 1 == _rx.size())
+            return false;
+
+        const char next = _rx[_idx + 1];
+
+        if (!_extended && next == '(')
+        {
+            _idx += 2;
+            return group(nullable);
+        }
+
+        // Only escaped operators are understood
+        if (std::string_view(_extended ?
+            ".[]\\()*+?{}|^$" :
+            ".[]\\*^$").find(next) == std::string_view::npos)
+        {
+            return false;
+        }
+
+        escape_regex(next, _out);
+        _idx += 2;
+        return true;
+    }
+    default:
+        if (_extended)
+        {
+            if (c == '(')
+            {
+                ++_idx;
+                return group(nullable);
+            }
+            else if (c == '+' || c == '?' || c == '{')
+                return false;
+        }
+
+        if (!supported(c))
+            return false;
+
+        escape_regex(c, _out);
+        ++_idx;
+        return true;
+    }
+}
+
+bool posix_converter::group(bool& nullable)
+{
+    _out += '(';
+
+    if (!alternation(false, nullable))
+        return false;
+
+    if (_extended && at(')'))
+        ++_idx;
+    else if (!_extended && at('\\') && at(')', 1))
+        _idx += 2;
+    else
+        return false;
+
+    _out += ')';
+    return true;
+}
+
+bool posix_converter::bracket()
+{
+    ++_idx;
+    _out += '[';
+
+    if (at('^'))
+    {
+        _out += '^';
+        ++_idx;
+    }
+
+    for (const std::size_t start = _idx; !at(']') || _idx == start; )
+    {
+        if (_idx == _rx.size())
+            return false;
+
+        const char c = _rx[_idx];
+
+        if (c == '[' && (at(':', 1) || at('=', 1) || at('.', 1)))
+        {
+            if (!char_class())
+                return false;
+
+            continue;
+        }
+
+        // ECMAScript escapes within a list are left to boost
+        if (!supported(c) || (_ecmascript && c == '\\'))
+            return false;
+
+        // '\\' is not an escape in a POSIX list, but is in lexertl.
+        // A '-' is only a range between two characters.
+        if (c == '-' && _idx != start && !at(']', 1))
+            _out += c;
+        else if (c == '\\' || c == '^' || c == '[' || c == ']' || c == '-')
+        {
+            _out += '\\';
+            _out += c;
+        }
+        else
+            _out += c;
+
+        ++_idx;
+    }
+
+    ++_idx;
+    _out += ']';
+    return true;
+}
+
+// [:name:] inside a bracket expression, as ASCII ranges.
+// Equivalence classes and collating elements are left to boost.
+bool posix_converter::char_class()
+{
+    struct posix_class
+    {
+        std::string_view _name;
+        const char* _ranges;
+    };
+
+    static constexpr posix_class classes[] =
+    {
+        { "alnum", "0-9A-Za-z" },
+        { "alpha", "A-Za-z" },
+        { "blank", " \\t" },
+        { "digit", "0-9" },
+        { "lower", "a-z" },
+        { "space", " \\t\\n\\v\\f\\r" },
+        { "upper", "A-Z" },
+        { "xdigit", "0-9A-Fa-f" }
+    };
+
+    if (!at(':', 1))
+        return false;
+
+    const std::size_t end = _rx.find(":]", _idx + 2);
+
+    if (end == std::string_view::npos)
+        return false;
+
+    const std::string_view name = _rx.substr(_idx + 2, end - _idx - 2);
+
+    for (const auto& cls : classes)
+    {
+        if (cls._name == name)
+        {
+            _out += cls._ranges;
+            _idx = end + 2;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool posix_converter::quantifier(bool& nullable)
+{
+    bool quantified = false;
+
+    while (_idx < _rx.size())
+    {
+        const char c = _rx[_idx];
+
+        // Stacked repeats are left to boost
+        if (quantified &&
+            (c == '*' || (_extended && (c == '+' || c == '?' || c == '{')) ||
+            (!_extended && c == '\\' && at('{', 1))))
+        {
+            return false;
+        }
+
+        if (c == '*' || (_extended && (c == '+' || c == '?')))
+        {
+            _out += c;
+            nullable |= c != '+';
+            ++_idx;
+        }
+        else if (_extended && c == '{')
+        {
+            ++_idx;
+
+            if (!interval(nullable))
+                return false;
+        }
+        else if (!_extended && c == '\\' && at('{', 1))
+        {
+            _idx += 2;
+
+            if (!interval(nullable))
+                return false;
+        }
+        else
+            break;
+
+        quantified = true;
+    }
+
+    return true;
+}
+
+// {m}, {m,} or {m,n}, having consumed the opening brace
+bool posix_converter::interval(bool& nullable)
+{
+    std::size_t min = 0;
+    std::size_t max = 0;
+    bool bounded = true;
+    auto number = [this](std::size_t& num)
+        {
+            const std::size_t start = _idx;
+
+            num = 0;
+
+            while (_idx < _rx.size() &&
+                std::isdigit(static_cast<unsigned char>(_rx[_idx])) &&
+                num <= g_max_repeat)
+            {
+                num = num * 10 + (_rx[_idx] - '0');
+                ++_idx;
+            }
+
+            return _idx != start && num <= g_max_repeat;
+        };
+
+    if (!number(min))
+        return false;
+
+    max = min;
+
+    if (at(','))
+    {
+        ++_idx;
+
+        if (_extended ? at('}') : at('\\'))
+            bounded = false;
+        else if (!number(max) || max < min)
+            return false;
+    }
+
+    if (_extended && at('}'))
+        ++_idx;
+    else if (!_extended && at('\\') && at('}', 1))
+        _idx += 2;
+    else
+        return false;
+
+    _out += '{';
+    _out += std::to_string(min);
+
+    if (!bounded)
+        _out += ',';
+    else if (max != min)
+    {
+        _out += ',';
+        _out += std::to_string(max);
+    }
+
+    _out += '}';
+    nullable |= min == 0;
+    return true;
+}
+
+static bool convert(posix_converter& converter, std::string& out)
+{
+    bool nullable = false;
+
+    if (!converter.alternation(true, nullable) ||
+        converter._idx != converter._rx.size() || nullable)
+    {
+        return false;
+    }
+
+    out = std::move(converter._out);
+    return true;
+}
+
+bool posix_to_lexertl(const std::string_view regex, const bool extended,
+    std::string& out)
+{
+    posix_converter converter;
+
+    converter._rx = regex;
+    converter._extended = extended;
+    return convert(converter, out);
+}
+
+bool ecmascript_to_lexertl(const std::string_view regex, std::string& out)
+{
+    posix_converter converter;
+
+    converter._rx = regex;
+    converter._extended = true;
+    converter._ecmascript = true;
+    return convert(converter, out);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// Converts a POSIX basic (grep) or extended (egrep) regex to lexertl syntax.
+// As both find the leftmost longest match, the regex can then be searched
+// for with a DFA instead of by backtracking.
+// Returns false (leaving the regex to boost) for anything a DFA cannot
+// reproduce exactly: back references, anchors, word boundaries and other
+// escapes, collating elements and regexes that can match nothing at all.
+bool posix_to_lexertl(const std::string_view regex, const bool extended,
+    std::string& out);
+// As above for the subset of ECMAScript syntax that reads the same as a
+// POSIX extended regex. Only use this where the match found does not
+// matter (just whether there is one), as ECMAScript finds the leftmost
+// first match rather than the longest.
+bool ecmascript_to_lexertl(const std::string_view regex, std::string& out);
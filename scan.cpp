@@ -0,0 +1,273 @@
+#include "pch.h"
+
+#include "scan.hpp"
+
+#include <lexertl/enums.hpp>
+#include <lexertl/rules.hpp>
+
+#include <bit>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GG_SSE2
+#include <emmintrin.h>
+#endif
+
+byte_scanner::byte_scanner()
+{
+    _table.fill(true);
+}
+
+byte_scanner::byte_scanner(const std::bitset<256>& bytes)
+{
+    for (std::size_t idx = 0; idx < bytes.size(); ++idx)
+    {
+        if (bytes[idx])
+        {
+            if (_count < max_simd)
+                _bytes[_count] = static_cast<char>(idx);
+
+            _table[idx] = true;
+            ++_count;
+        }
+    }
+
+    if (_count == 0)
+        _mode = mode::none;
+    else if (_count == bytes.size())
+        _mode = mode::all;
+    else if (_count == 1)
+        _mode = mode::single;
+#ifdef GG_SSE2
+    else if (_count <= max_simd)
+        _mode = mode::simd;
+#endif
+    else
+        _mode = mode::table;
+}
+
+const char* byte_scanner::find(const char* first, const char* second) const
+{
+    switch (_mode)
+    {
+    case mode::all:
+        return first;
+    case mode::none:
+        return second;
+    case mode::single:
+    {
+        const void* ptr = std::memchr(first, _bytes[0], second - first);
+
+        return ptr ? static_cast<const char*>(ptr) : second;
+    }
+#ifdef GG_SSE2
+    case mode::simd:
+    {
+        __m128i needles[max_simd];
+
+        for (std::size_t idx = 0; idx < _count; ++idx)
+            needles[idx] = _mm_set1_epi8(_bytes[idx]);
+
+        for (; second - first >= 16; first += 16)
+        {
+            const __m128i block =
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+            __m128i eq = _mm_cmpeq_epi8(block, needles[0]);
+
+            for (std::size_t idx = 1; idx < _count; ++idx)
+                eq = _mm_or_si128(eq, _mm_cmpeq_epi8(block, needles[idx]));
+
+            if (const int mask = _mm_movemask_epi8(eq))
+                return first +
+                    std::countr_zero(static_cast<unsigned int>(mask));
+        }
+
+        break;
+    }
+#endif
+    default:
+        break;
+    }
+
+    // Table scan, also used for the tail of the SIMD scan
+    for (; first != second; ++first)
+    {
+        if (_table[static_cast<unsigned char>(*first)])
+            break;
+    }
+
+    return first;
+}
+
+static char fold(const char c)
+{
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+#ifdef GG_SSE2
+static bool is_alpha(const char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+#endif
+
+text_scanner::text_scanner(const std::string& text, const bool icase) :
+    _text(text),
+    _icase(icase)
+{
+    if (_icase)
+    {
+        for (char& c : _text)
+            c = fold(c);
+    }
+}
+
+const char* text_scanner::find(const char* first, const char* second) const
+{
+    const std::size_t size = _text.size();
+
+    if (size == 0 || static_cast<std::size_t>(second - first) < size)
+        return second;
+
+    // Last position a match can start at
+    const char* last = second - size;
+
+#ifdef GG_SSE2
+    // A letter matches either case if bit 5 is forced on before comparing
+    const char first_mask = _icase && is_alpha(_text.front()) ? 0x20 : 0;
+    const char last_mask = _icase && is_alpha(_text.back()) ? 0x20 : 0;
+    const __m128i first_byte = _mm_set1_epi8(_text.front());
+    const __m128i last_byte = _mm_set1_epi8(_text.back());
+    const __m128i first_or = _mm_set1_epi8(first_mask);
+    const __m128i last_or = _mm_set1_epi8(last_mask);
+
+    for (; last - first >= 16; first += 16)
+    {
+        const __m128i head = _mm_or_si128(first_or,
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(first)));
+        const __m128i tail = _mm_or_si128(last_or,
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(first +
+                size - 1)));
+        auto mask = static_cast<unsigned int>(_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(head, first_byte),
+                _mm_cmpeq_epi8(tail, last_byte))));
+
+        for (; mask; mask &= mask - 1)
+        {
+            const char* curr = first + std::countr_zero(mask);
+
+            if (equal(curr))
+                return curr;
+        }
+    }
+#endif
+
+    if (_icase)
+    {
+        for (; first <= last; ++first)
+        {
+            if (fold(*first) == _text.front() && equal(first))
+                return first;
+        }
+    }
+    else
+    {
+        for (; first <= last; ++first)
+        {
+            first = static_cast<const char*>(std::memchr(first,
+                _text.front(), last - first + 1));
+
+            if (!first)
+                break;
+
+            if (equal(first))
+                return first;
+        }
+    }
+
+    return second;
+}
+
+bool text_scanner::equal(const char* first) const
+{
+    if (!_icase)
+        return std::memcmp(first, _text.c_str(), _text.size()) == 0;
+
+    for (const char c : _text)
+    {
+        if (fold(*first++) != c)
+            return false;
+    }
+
+    return true;
+}
+
+std::size_t count_bytes(const char* first, const char* second, const char c)
+{
+    std::size_t count = 0;
+
+#ifdef GG_SSE2
+    const __m128i needle = _mm_set1_epi8(c);
+
+    for (; second - first >= 16; first += 16)
+    {
+        const __m128i block =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+
+        count += std::popcount(static_cast<unsigned int>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle))));
+    }
+#endif
+
+    for (; first != second; ++first)
+    {
+        if (*first == c)
+            ++count;
+    }
+
+    return count;
+}
+
+byte_scanner start_scanner(const lexertl::state_machine& sm,
+    const bool ignore_invalid)
+{
+    // Use the lexertl enum operator
+    using namespace lexertl;
+    using id_type = state_machine::id_type;
+    const auto& internals = sm.data();
+
+    if (sm.empty() || internals._dfa.size() != 1 ||
+        internals._features & (*feature_bit::bol | *feature_bit::eol))
+        return byte_scanner();
+
+    const auto& lookup = internals._lookup[0];
+    const id_type alphabet = internals._dfa_alphabet[0];
+    const id_type* dfa = internals._dfa[0].data();
+    // Row 0 is the dead state, row 1 is the start state
+    const id_type* start = dfa + alphabet;
+    std::bitset<256> bytes;
+
+    for (std::size_t idx = 0; idx < bytes.size(); ++idx)
+    {
+        const id_type state = start[lookup[idx]];
+
+        if (state == 0)
+        {
+            bytes[idx] = !ignore_invalid;
+            continue;
+        }
+
+        const id_type* ptr = dfa + state * alphabet;
+        bool candidate = !*ptr ||
+            ptr[*state_index::id] != rules::skip();
+
+        // A skip() token that could be longer than one byte
+        for (std::size_t c = 0; !candidate && c < lookup.size(); ++c)
+            candidate = ptr[lookup[c]] != 0;
+
+        bytes[idx] = candidate;
+    }
+
+    return byte_scanner(bytes);
+}
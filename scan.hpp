@@ -0,0 +1,74 @@
+#pragma once
+
+#include <lexertl/state_machine.hpp>
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <string>
+
+// Finds the next byte that is a member of a fixed set.
+// Up to max_simd distinct bytes are searched for 16 bytes at a time
+// (memchr() for a single byte), larger sets fall back to a table.
+class byte_scanner
+{
+public:
+    // Default constructed scanners match every byte.
+    byte_scanner();
+    explicit byte_scanner(const std::bitset<256>& bytes);
+
+    // Returns second if there is no member of the set in [first, second).
+    const char* find(const char* first, const char* second) const;
+
+private:
+    enum class mode
+    {
+        all, none, single, simd, table
+    };
+
+    static constexpr std::size_t max_simd = 8;
+
+    mode _mode = mode::all;
+    std::size_t _count = 0;
+    std::array<char, max_simd> _bytes{};
+    std::array<bool, 256> _table{};
+};
+
+// Finds a fixed string, optionally ignoring (ASCII) case.
+// Candidates are found by comparing the first and last bytes of the
+// string against 16 byte blocks, and only those are compared in full.
+class text_scanner
+{
+public:
+    text_scanner() = default;
+    text_scanner(const std::string& text, const bool icase);
+
+    const std::string& text() const
+    {
+        return _text;
+    }
+
+    // Returns second if text() does not occur in [first, second).
+    const char* find(const char* first, const char* second) const;
+
+private:
+    // Lower case if _icase
+    std::string _text;
+    bool _icase = false;
+
+    bool equal(const char* first) const;
+};
+
+// Returns the number of occurrences of c in [first, second).
+std::size_t count_bytes(const char* first, const char* second, const char c);
+
+// Builds a scanner for the bytes that can begin a token from the
+// INITIAL state of sm. Bytes that can only ever produce a one byte
+// skip() token (typically the "(?s:.)" rule that allows a lexer to
+// search) are excluded, as are bytes with no transition at all if
+// ignore_invalid is set (a parser can never start a match on an invalid
+// token). As all tokens before the first remaining byte are one byte
+// long, the DFA can safely be started at that byte instead.
+// State machines using start states, ^ or $ are not analysed.
+byte_scanner start_scanner(const lexertl::state_machine& sm,
+    const bool ignore_invalid);
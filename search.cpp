@@ -1,7 +1,12 @@
 #include "pch.h"
 
 #include "gg_error.hpp"
+#include "multi_start.hpp"
+#include "output.hpp"
+#include "parser.hpp"
+#include "scan.hpp"
 #include "search.hpp"
+#include "token_cache.hpp"
 #include "types.hpp"
 
 #include <lexertl/iterator.hpp>
@@ -29,17 +34,19 @@
 
 extern boost::regex g_capture_rx;
 extern options g_options;
-extern pipeline g_pipeline;
 
-extern lexertl::state_machine word_lexer();
 extern std::string unescape(const std::string_view& vw);
 
-using results = std::vector<std::vector<std::pair
+// Reused, so that boost only allocates the sub-matches once per thread
+static thread_local boost::cmatch t_what;
+
+using results = std::pmr::vector<std::pmr::vector<std::pair
     <const char*, const char*>>>;
-using prod_map_t = std::vector<std::pair<uint16_t, token::token_vector>>;
-using uresults = std::vector<std::vector<std::pair
+using prod_map_t = std::pmr::vector<std::pair<uint16_t,
+    parsertl::token<token_iterator>::token_vector>>;
+using uresults = std::pmr::vector<std::pmr::vector<std::pair
     <utf8_in_iterator, utf8_in_iterator>>>;
-using uprod_map_t = std::vector<std::pair<uint16_t,
+using uprod_map_t = std::pmr::vector<std::pair<uint16_t,
     parsertl::token<crutf8iterator>::token_vector>>;
 
 static const char* get_ptr(const char* ptr)
@@ -84,6 +91,16 @@ static const char* get_second(const lexertl::criterator& iter)
     return iter->second;
 }
 
+static const char* get_first(const token_iterator& iter)
+{
+    return iter->first;
+}
+
+static const char* get_second(const token_iterator& iter)
+{
+    return iter->second;
+}
+
 static const char* get_first(const crutf8iterator& iter)
 {
     return iter->first.get();
@@ -110,7 +127,8 @@ const auto& dollar(const uint16_t rule_, const std::size_t index_,
 }
 
 static std::string format_item(const std::string& input,
-    const std::pair<uint16_t, token::token_vector>& item)
+    const std::pair<uint16_t,
+    parsertl::token<token_iterator>::token_vector>& item)
 {
     std::string output;
     const char* last = input.c_str();
@@ -165,30 +183,35 @@ static std::string format_item(const std::string& input,
     return unescape(output);
 }
 
+// Any condition matching any of its captures will do, so the conditions
+// searched with a DFA are tried before those left to boost.
 template<typename T>
-bool conditions_met(const condition_map& conditions, const T& cap_vec)
+bool conditions_met(const condition_map& conditions, const T& cap_vec,
+    condition_cache& cond_cache)
 {
-    bool success = conditions.empty();
+    if (conditions.empty())
+        return true;
 
-    for (const auto& [idx, rx] : conditions)
+    for (const bool dfa : { true, false })
     {
-        if (idx >= cap_vec.size())
-            throw gg_error(std::format("${} is out of range", idx));
-
-        for (const auto& cap : cap_vec[idx])
+        for (const auto& [idx, cond] : conditions)
         {
-            if (boost::regex_search(get_first(cap), get_second(cap), rx))
+            if (cond._sm.empty() == dfa)
+                continue;
+
+            // As before, only a condition that is reached is checked
+            if (idx >= cap_vec.size())
+                throw gg_error(std::format("${} is out of range", idx));
+
+            for (const auto& cap : cap_vec[idx])
             {
-                success = true;
-                break;
+                if (cond_cache.search(cond, get_first(cap), get_second(cap)))
+                    return true;
             }
         }
-
-        if (success)
-            break;
     }
 
-    return success;
+    return false;
 }
 
 template<typename token_vector>
@@ -211,11 +234,12 @@ std::vector<std::string> production_to_strings(const uint16_t rule_,
 
 template<typename parser_t, typename token_vector>
 void process_action(const parser_t& p, const char* start,
-    const std::map<uint16_t, actions>::iterator& action_iter,
+    const std::map<uint16_t, actions>::const_iterator& action_iter,
     const std::pair<uint16_t, token_vector>& item,
-    std::stack<std::string>& matches,
-    std::map<std::pair<std::size_t, std::size_t>, std::string>& replacements,
-    std::map<std::string, std::string, std::less<>>& vars)
+    match_stack& matches,
+    edit_log& replacements,
+    std::map<std::string, std::string, std::less<>>& vars,
+    exec_state& state)
 {
     for (const auto cmd : action_iter->second._commands)
     {
@@ -228,7 +252,8 @@ void process_action(const parser_t& p, const char* start,
             auto c = static_cast<append_cmd*>(cmd);
             std::vector<std::string> params = production_to_strings(item.first,
                 p._gsm, productions);
-            std::string rhs = action_iter->second.exec(c->_param, params, &vars);
+            std::string rhs = action_iter->second.exec(c->_param, params,
+                &vars, state);
 
             vars[c->_name] += std::move(rhs);
             break;
@@ -238,7 +263,8 @@ void process_action(const parser_t& p, const char* start,
             auto c = static_cast<assign_cmd*>(cmd);
             std::vector<std::string> params = production_to_strings(item.first,
                 p._gsm, productions);
-            std::string rhs = action_iter->second.exec(c->_param, params, &vars);
+            std::string rhs = action_iter->second.exec(c->_param, params,
+                &vars, state);
 
             vars[c->_name] = std::move(rhs);
             break;
@@ -257,8 +283,7 @@ void process_action(const parser_t& p, const char* start,
                     get_ptr(param2.second) :
                     get_ptr(param2.first)) - start;
 
-                replacements[std::pair(index1, index2 - index1)] =
-                    std::string();
+                replacements.add(index1, index2 - index1, std::string_view());
             }
 
             break;
@@ -274,8 +299,8 @@ void process_action(const parser_t& p, const char* start,
                 std::vector<std::string> params = production_to_strings(item.first,
                     p._gsm, productions);
 
-                replacements[std::pair(index, 0)] =
-                    action_iter->second.exec(c->_param, params, &vars);
+                replacements.add(index, 0, action_iter->second.exec(c->_param,
+                    params, &vars, state));
             }
 
             break;
@@ -340,8 +365,8 @@ void process_action(const parser_t& p, const char* start,
             std::vector<std::string> params = production_to_strings(item.first,
                 p._gsm, productions);
 
-            std::cout << format_item(action_iter->second.
-                exec(cmd, params, &vars), item);
+            output_stream() << format_item(action_iter->second.
+                exec(cmd, params, &vars, state), item);
             break;
         }
         case cmd::type::replace:
@@ -363,8 +388,9 @@ void process_action(const parser_t& p, const char* start,
                 std::vector<std::string> params = production_to_strings(item.first,
                     p._gsm, productions);
 
-                replacements[std::pair(index1, index2 - index1)] =
-                    action_iter->second.exec(c->_param, params, &vars);
+                replacements.add(index1, index2 - index1,
+                    action_iter->second.exec(c->_param, params, &vars,
+                        state));
             }
 
             break;
@@ -437,14 +463,19 @@ static bool is_bol_eol(const char* data_first, const char* first,
 }
 
 static bool process_text(const text& t, const char* data_first,
-    std::vector<match>& ranges, capture_vector& captures)
+    match_vector& ranges, capture_vector& captures,
+    condition_cache& cond_cache)
 {
     // Use the lexertl enum operator
     using namespace lexertl;
-    const std::string text = build_text(t._text, captures);
+    const text_scanner scanner = t._scanner ? text_scanner() :
+        text_scanner(build_text(t._text, captures),
+            (t._flags & *config_flags::icase) != 0);
+    const text_scanner& searcher = t._scanner ? *t._scanner : scanner;
+    const std::string& text = searcher.text();
     const char* first = ranges.back()._first;
     const char* second = ranges.back()._eoi;
-    results cap_vec;
+    results cap_vec(ranges.get_allocator());
     bool success = false;
 
     cap_vec.emplace_back();
@@ -453,15 +484,7 @@ static bool process_text(const text& t, const char* data_first,
     do
     {
         first = text.empty() ? ranges.back()._eoi :
-            (t._flags & *config_flags::icase) ?
-            std::search(first, second, &text.front(),
-                &text.front() + text.size(),
-                [](const char lhs, const char rhs)
-                {
-                    return ::tolower(lhs) == ::tolower(rhs);
-                })
-            : std::search(first, second, &text.front(),
-                &text.front() + text.size());
+            searcher.find(first, second);
         second = first + text.size();
         success = first != ranges.back()._eoi;
 
@@ -474,7 +497,7 @@ static bool process_text(const text& t, const char* data_first,
             ranges.front()._eoi, t._flags) &&
             is_bol_eol(data_first, first, second, ranges.front()._eoi,
                 t._flags) &&
-            conditions_met(t._conditions, cap_vec);
+            conditions_met(t._conditions, cap_vec, cond_cache);
 
         if (!success)
         {
@@ -551,36 +574,100 @@ static bool process_text(const text& t, const char* data_first,
     return success;
 }
 
-static bool process_regex(const regex& r, const char* data_first,
-    std::vector<match>& ranges, capture_vector& captures)
+// lexer_t is a lexer, or a regex that can be searched as a DFA
+template<typename lexer_t>
+static std::pair<bool, lexertl::criterator> lexer_search(const lexer_t& l,
+    const char* data_first, match_vector& ranges,
+    condition_cache& cond_cache)
 {
-    // Use the lexertl enum operator
-    using namespace lexertl;
-    boost::cregex_iterator iter(ranges.back()._first, ranges.back()._eoi,
-        r._rx, boost::regex_constants::match_not_dot_newline);
-    boost::cregex_iterator end;
-    results cap_vec;
-    bool success = iter != end;
+    lexertl::criterator iter(l._scanner.find(ranges.back()._first,
+        ranges.back()._eoi), ranges.back()._eoi, l._sm);
+    results cap_vec(ranges.get_allocator());
+    bool success = iter->first != ranges.back()._eoi;
+
+    cap_vec.emplace_back();
+    cap_vec.back().emplace_back(iter->first, iter->second);
+
+    while (success && (!is_whole_word(data_first,
+        iter->first, iter->second, ranges.front()._eoi, l._flags) ||
+        !is_bol_eol(data_first, iter->first, iter->second, ranges.front()._eoi,
+            l._flags) ||
+        !conditions_met(l._conditions, cap_vec, cond_cache)))
+    {
+        iter = lexertl::criterator(l._scanner.find(iter->second, iter->eoi),
+            iter->eoi, l._sm);
+        success = iter->first != ranges.back()._eoi;
+
+        if (!success)
+            break;
+
+        cap_vec.back().back().first = iter->first;
+        cap_vec.back().back().second = iter->second;
+    }
+
+    return std::make_pair(success, std::move(iter));
+}
+
+static bool boost_search(const regex& r, const char* data_first,
+    match_vector& ranges, condition_cache& cond_cache, boost::cmatch& what)
+{
+    results cap_vec(ranges.get_allocator());
+    bool success = boost::regex_search(ranges.back()._first,
+        ranges.back()._eoi, what, r._rx,
+        boost::regex_constants::match_not_dot_newline);
 
     cap_vec.emplace_back();
-    cap_vec.back().emplace_back(iter == end ?
-        boost::csub_match{} :
-        (*iter)[0]);
+    cap_vec.back().emplace_back(success ?
+        what[0] :
+        boost::csub_match{});
 
     while (success && (!is_whole_word(data_first,
-        (*iter)[0].first, (*iter)[0].second, ranges.front()._eoi, r._flags) ||
-        !is_bol_eol(data_first, (*iter)[0].first, (*iter)[0].second,
+        what[0].first, what[0].second, ranges.front()._eoi, r._flags) ||
+        !is_bol_eol(data_first, what[0].first, what[0].second,
             ranges.front()._eoi, r._flags) ||
-        !conditions_met(r._conditions, cap_vec)))
+        !conditions_met(r._conditions, cap_vec, cond_cache)))
     {
-        iter = boost::cregex_iterator((*iter)[0].second, ranges.back()._eoi,
-            r._rx, boost::regex_constants::match_not_dot_newline);
-        success = iter != end;
+        success = boost::regex_search(what[0].second, ranges.back()._eoi,
+            what, r._rx, boost::regex_constants::match_not_dot_newline);
 
         if (!success)
             break;
 
-        cap_vec.back().back() = (*iter)[0];
+        cap_vec.back().back() = what[0];
+    }
+
+    return success;
+}
+
+static bool process_regex(const regex& r, const char* data_first,
+    match_vector& ranges, capture_vector& captures,
+    condition_cache& cond_cache)
+{
+    // Use the lexertl enum operator
+    using namespace lexertl;
+    boost::cmatch& what = t_what;
+    bool success = false;
+    // The whole match
+    const char* first = nullptr;
+    const char* second = nullptr;
+
+    if (r._sm.empty())
+    {
+        success = boost_search(r, data_first, ranges, cond_cache, what);
+
+        if (success)
+        {
+            first = what[0].first;
+            second = what[0].second;
+        }
+    }
+    else
+    {
+        auto [found, iter] = lexer_search(r, data_first, ranges, cond_cache);
+
+        success = found;
+        first = iter->first;
+        second = iter->second;
     }
 
     if (success)
@@ -594,41 +681,39 @@ static bool process_regex(const regex& r, const char* data_first,
                 const char* last_start = ranges.back()._first;
 
                 if (!(r._flags & *config_flags::ret_prev_match))
-                    ranges.back()._second = (*iter)[0].second;
+                    ranges.back()._second = second;
 
-                if (last_start == (*iter)[0].first)
+                if (last_start == first)
                 {
                     if (!(r._flags & *config_flags::ret_prev_match))
                         // The match is right at the beginning, so skip.
-                        ranges.emplace_back((*iter)[0].second, (*iter)[0].second,
-                            (*iter)[0].second);
+                        ranges.emplace_back(second, second, second);
 
                     success = false;
                 }
                 else if (!(r._flags & *config_flags::ret_prev_match))
                 {
                     // Store end of match
-                    ranges.back()._second = (*iter)[0].second;
-                    ranges.emplace_back(ranges.back()._first, (*iter)[0].first,
-                        (*iter)[0].first);
+                    ranges.back()._second = second;
+                    ranges.emplace_back(ranges.back()._first, first, first);
                 }
             }
         }
         else if(!(r._flags & *config_flags::ret_prev_match))
         {
             // Store start of match
-            ranges.back()._first = (*iter)[0].first;
+            ranges.back()._first = first;
             // Store end of match
-            ranges.back()._second = (*iter)[0].second;
+            ranges.back()._second = second;
             ranges.emplace_back((r._flags & *config_flags::extend_search) ?
-                (*iter)[0].second :
-                (*iter)[0].first,
+                second :
+                first,
                 (r._flags & *config_flags::extend_search) ?
-                (*iter)[0].second :
-                (*iter)[0].first,
+                second :
+                first,
                 (r._flags & *config_flags::extend_search) ?
                 ranges.back()._eoi :
-                (*iter)[0].second);
+                second);
         }
     }
     else if (r._flags & *config_flags::negate &&
@@ -654,9 +739,19 @@ static bool process_regex(const regex& r, const char* data_first,
             captures.back().emplace_back(ranges.back()._first,
                 ranges.back()._second);
         }
+        // Captures are only extracted from a DFA match now,
+        // and only from the span that matched (boost allocates when
+        // matching POSIX regexes, so not at all without groups).
+        else if (!r._sm.empty() && (r._rx.mark_count() == 0 ||
+            !boost::regex_match(first, second, what, r._rx,
+                boost::regex_constants::match_not_dot_newline)))
+        {
+            captures.emplace_back();
+            captures.back().emplace_back(first, second);
+        }
         else
         {
-            for (const auto& m : *iter)
+            for (const auto& m : what)
             {
                 captures.emplace_back();
                 captures.back().emplace_back(m.first, m.second);
@@ -667,42 +762,13 @@ static bool process_regex(const regex& r, const char* data_first,
     return success;
 }
 
-static std::pair<bool, lexertl::criterator> lexer_search(const lexer& l,
-    const char* data_first, std::vector<match>& ranges)
-{
-    lexertl::criterator iter(ranges.back()._first,
-        ranges.back()._eoi, l._sm);
-    results cap_vec;
-    bool success = iter->first != ranges.back()._eoi;
-
-    cap_vec.emplace_back();
-    cap_vec.back().emplace_back(iter->first, iter->second);
-
-    while (success && (!is_whole_word(data_first,
-        iter->first, iter->second, ranges.front()._eoi, l._flags) ||
-        !is_bol_eol(data_first, iter->first, iter->second, ranges.front()._eoi,
-            l._flags) ||
-        !conditions_met(l._conditions, cap_vec)))
-    {
-        iter = lexertl::criterator(iter->second, iter->eoi, l._sm);
-        success = iter->first != ranges.back()._eoi;
-
-        if (!success)
-            break;
-
-        cap_vec.back().back().first = iter->first;
-        cap_vec.back().back().second = iter->second;
-    }
-
-    return std::make_pair(success, std::move(iter));
-}
-
 static std::pair<bool, crutf8iterator> lexer_search(const ulexer& l,
-    const char* data_first, std::vector<match>& ranges)
+    const char* data_first, match_vector& ranges,
+    condition_cache& cond_cache)
 {
     crutf8iterator iter(utf8_in_iterator(ranges.back()._first, ranges.back()._eoi),
         utf8_in_iterator(ranges.back()._eoi, ranges.back()._eoi), l._sm);
-    results cap_vec;
+    results cap_vec(ranges.get_allocator());
     bool success =
         iter->first != utf8_in_iterator(ranges.back()._eoi, ranges.back()._eoi);
 
@@ -713,7 +779,7 @@ static std::pair<bool, crutf8iterator> lexer_search(const ulexer& l,
         iter->second.get(), ranges.front()._eoi, l._flags) ||
         !is_bol_eol(data_first, iter->first.get(), iter->second.get(),
             ranges.front()._eoi, l._flags) ||
-        !conditions_met(l._conditions, cap_vec)))
+        !conditions_met(l._conditions, cap_vec, cond_cache)))
     {
         iter = crutf8iterator(utf8_in_iterator(iter->second.get(), iter->eoi.get()),
             utf8_in_iterator(iter->eoi.get(), iter->eoi.get()), l._sm);
@@ -732,11 +798,12 @@ static std::pair<bool, crutf8iterator> lexer_search(const ulexer& l,
 
 template<typename lexer_t>
 bool process_lexer(const lexer_t& l, const char* data_first,
-    std::vector<match>& ranges, capture_vector& captures)
+    match_vector& ranges, capture_vector& captures,
+    condition_cache& cond_cache)
 {
     // Use the lexertl enum operator
     using namespace lexertl;
-    auto [success, iter] = lexer_search(l, data_first, ranges);
+    auto [success, iter] = lexer_search(l, data_first, ranges, cond_cache);
 
     if (success)
     {
@@ -809,41 +876,58 @@ bool process_lexer(const lexer_t& l, const char* data_first,
     return success;
 }
 
-static std::tuple<lexertl::criterator, lexertl::criterator, prod_map_t, results>
-get_iterators(const parser& p, const std::vector<match>& ranges)
+// Failed parse attempts restart at the next token, so the tokens are
+// read from the cache rather than lexed again.
+static std::tuple<token_iterator, token_iterator, prod_map_t, results>
+get_iterators(const parser& p, const match_vector& ranges,
+    token_cache& tokens)
 {
-    lexertl::criterator iter(ranges.back()._first,
-        ranges.back()._eoi, p._lsm);
+    token_iterator iter = tokens.begin(p._lsm,
+        p._scanner.find(ranges.back()._first, ranges.back()._eoi),
+        ranges.back()._eoi);
 
-    return std::make_tuple(std::move(iter), lexertl::criterator(),
-        prod_map_t(), results());
+    return std::make_tuple(std::move(iter), token_iterator(),
+        prod_map_t(ranges.get_allocator()),
+        results(ranges.get_allocator()));
 }
 
 static std::tuple<crutf8iterator, crutf8iterator, uprod_map_t, uresults>
-get_iterators(const uparser& p, const std::vector<match>& ranges)
+get_iterators(const uparser& p, const match_vector& ranges, token_cache&)
 {
     crutf8iterator iter(utf8_in_iterator(ranges.back()._first, ranges.back()._eoi),
         utf8_in_iterator(ranges.back()._eoi, ranges.back()._eoi), p._lsm);
 
     return std::make_tuple(std::move(iter), crutf8iterator(),
-        uprod_map_t(), uresults());
+        uprod_map_t(ranges.get_allocator()),
+        uresults(ranges.get_allocator()));
 }
 
 template<typename parser_t>
-bool process_parser(parser_t& p, const char* data_first,
-    std::vector<match>& ranges, std::stack<std::string>& matches,
-    std::map<std::pair<std::size_t, std::size_t>, std::string>& replacements,
-    capture_vector& captures)
+bool process_parser(const parser_t& p, search_context& context,
+    const char* data_first, match_vector& ranges,
+    match_stack& matches,
+    edit_log& replacements,
+    capture_vector& captures, token_cache& tokens,
+    condition_cache& cond_cache)
 {
     using enum config_flags;
     // Use the lexertl enum operator
     using namespace lexertl;
-    auto [iter, end, prod_map, cap_vec] = get_iterators(p, ranges);
+    auto [iter, end, prod_map, cap_vec] = get_iterators(p, ranges, tokens);
     const bool has_captures = !p._gsm._captures.empty();
     bool success = false;
 
     do
     {
+        // Not with --utf8, as moving a crutf8iterator up to the start
+        // found would lex every token it passes a second time.
+        if constexpr (std::is_same_v<parser_t, parser>)
+        {
+            if (p._flags & *single_pass)
+                find_match_start(iter, p._gsm,
+                    ranges.get_allocator().resource());
+        }
+
         if (has_captures)
             success = parsertl::search(iter, end, p._gsm, cap_vec);
         else
@@ -856,7 +940,7 @@ bool process_parser(parser_t& p, const char* data_first,
             ranges.front()._eoi, p._flags) &&
             is_bol_eol(data_first, get_first(iter), get_first(end),
                 ranges.front()._eoi, p._flags) &&
-            conditions_met(p._conditions, cap_vec);
+            conditions_met(p._conditions, cap_vec, cond_cache);
 
         if (!success)
             iter = end;
@@ -931,7 +1015,7 @@ bool process_parser(parser_t& p, const char* data_first,
                 if (action_iter != p._actions.end())
                 {
                     process_action(p, data_first, action_iter, item, matches,
-                        replacements, vars);
+                        replacements, vars, context._exec);
 
                     if (!(p._flags & *ret_prev_match))
                     {
@@ -1012,16 +1096,17 @@ bool process_parser(parser_t& p, const char* data_first,
 }
 
 static bool process_word_list(const word_list& w, const char* data_first,
-    std::vector<match>& ranges, capture_vector& captures)
+    match_vector& ranges, capture_vector& captures,
+    condition_cache& cond_cache)
 {
     // Use the lexertl enum operator
     using namespace lexertl;
     std::string_view text;
-    const lexertl::state_machine sm = word_lexer();
+    const lexertl::state_machine& sm = word_lexer();
     lexertl::citerator iter(ranges.back()._first, ranges.back()._eoi, sm);
     const char* first = ranges.back()._first;
     const char* second = ranges.back()._eoi;
-    results cap_vec;
+    results cap_vec(ranges.get_allocator());
     bool success = false;
 
     cap_vec.emplace_back();
@@ -1030,35 +1115,7 @@ static bool process_word_list(const word_list& w, const char* data_first,
     for (; iter->id != 0; ++iter)
     {
         text = iter->view();
-
-        if (w._flags & *config_flags::icase)
-        {
-            auto list_iter = std::find_if(w._list.begin(), w._list.end(),
-                [&text](const std::string_view& rhs)
-                {
-                    if (text.size() != rhs.size())
-                        return false;
-                    else
-                    {
-                        for (std::size_t idx = 0, size = text.size(); idx < size; ++idx)
-                        {
-                            if (::tolower(text[idx]) != ::tolower(rhs[idx]))
-                                return false;
-                        }
-
-                        return true;
-                    }
-                });
-
-            success = list_iter != w._list.end();
-        }
-        else
-        {
-            auto list_iter = std::ranges::lower_bound(w._list, text);
-
-            success = list_iter != w._list.end() && *list_iter == text;
-        }
-
+        success = w._words.contains(text);
         first = iter->first;
         second = iter->second;
 
@@ -1070,7 +1127,7 @@ static bool process_word_list(const word_list& w, const char* data_first,
                 ranges.front()._eoi, w._flags) &&
                 is_bol_eol(data_first, first, second, ranges.front()._eoi,
                     w._flags) &&
-                conditions_met(w._conditions, cap_vec);
+                conditions_met(w._conditions, cap_vec, cond_cache);
 
             if (success)
                 break;
@@ -1150,26 +1207,28 @@ static bool process_word_list(const word_list& w, const char* data_first,
     return success;
 }
 
-bool search(match_data& data,
-    std::map<std::pair<std::size_t, std::size_t>, std::string>& replacements)
+bool search(const pipeline& stages, search_context& context,
+    match_data& data,
+    edit_log& replacements)
 {
     bool success = false;
 
     data._negate = false;
 
-    for (std::size_t index = data._ranges.size() - 1, size = g_pipeline.size();
+    for (std::size_t index = data._ranges.size() - 1, size = stages.size();
         index < size; ++index)
     {
         // Use the lexertl enum operator
         using namespace lexertl;
 
-        switch (auto& v = g_pipeline[index]; static_cast<match_type>(v.index()))
+        switch (const auto& v = stages[index]; static_cast<match_type>(v.index()))
         {
         case match_type::text:
         {
             const auto& t = std::get<text>(v);
 
-            success = process_text(t, data._first, data._ranges, data._captures);
+            success = process_text(t, data._first, data._ranges, data._captures,
+                data._condition_cache);
             data._negate = (t._flags & *config_flags::negate) != 0;
             break;
         }
@@ -1177,7 +1236,8 @@ bool search(match_data& data,
         {
             const auto& r = std::get<regex>(v);
 
-            success = process_regex(r, data._first, data._ranges, data._captures);
+            success = process_regex(r, data._first, data._ranges, data._captures,
+                data._condition_cache);
             data._negate = (r._flags & *config_flags::negate) != 0;
             break;
         }
@@ -1185,7 +1245,8 @@ bool search(match_data& data,
         {
             const auto& l = std::get<lexer>(v);
 
-            success = process_lexer(l, data._first, data._ranges, data._captures);
+            success = process_lexer(l, data._first, data._ranges, data._captures,
+                data._condition_cache);
             data._negate = (l._flags & *config_flags::negate) != 0;
             break;
         }
@@ -1193,29 +1254,28 @@ bool search(match_data& data,
         {
             const auto& l = std::get<ulexer>(v);
 
-            success = process_lexer(l, data._first, data._ranges, data._captures);
+            success = process_lexer(l, data._first, data._ranges, data._captures,
+                data._condition_cache);
             data._negate = (l._flags & *config_flags::negate) != 0;
             break;
         }
         case match_type::parser:
         {
-            // Not const as the parser holds state
-            // that needs to be mutable (unlike other types)
-            auto& p = std::get<parser>(v);
+            const auto& p = std::get<parser>(v);
 
-            success = process_parser(p, data._first, data._ranges, data._matches,
-                replacements, data._captures);
+            success = process_parser(p, context, data._first, data._ranges,
+                data._matches, replacements, data._captures, data._tokens,
+                data._condition_cache);
             data._negate = (p._flags & *config_flags::negate) != 0;
             break;
         }
         case match_type::uparser:
         {
-            // Not const as the uparser holds state
-            // that needs to be mutable (unlike other types)
-            auto& p = std::get<uparser>(v);
+            const auto& p = std::get<uparser>(v);
 
-            success = process_parser(p, data._first, data._ranges, data._matches,
-                replacements, data._captures);
+            success = process_parser(p, context, data._first, data._ranges,
+                data._matches, replacements, data._captures, data._tokens,
+                data._condition_cache);
             data._negate = (p._flags & *config_flags::negate) != 0;
             break;
         }
@@ -1224,7 +1284,7 @@ bool search(match_data& data,
             const auto& words = std::get<word_list>(v);
 
             success = process_word_list(words, data._first, data._ranges,
-                data._captures);
+                data._captures, data._condition_cache);
             data._negate = (words._flags & *config_flags::negate) != 0;
             break;
         }
@@ -1237,3 +1297,33 @@ bool search(match_data& data,
 
     return success;
 }
+
+bool next_range(match_data& data)
+{
+    const match old = data._ranges.back();
+
+    data._ranges.pop_back();
+
+    if (data._ranges.empty())
+        return false;
+
+    // Cleardown any stale strings in matches.
+    // First makes sure current range is not from the same
+    // string (in matches) as the last.
+    if (const auto& curr = data._ranges.back();
+        !data._matches.empty() &&
+        (old._first < curr._first || old._first > curr._eoi))
+    {
+        while (!data._matches.empty() &&
+            old._first >= data._matches.top().c_str() &&
+            old._eoi <= data._matches.top().c_str() +
+            data._matches.top().size())
+        {
+            data._matches.pop();
+        }
+    }
+
+    // Start searching from end of last match
+    data._ranges.back()._first = data._ranges.back()._second;
+    return true;
+}
@@ -2,9 +2,33 @@
 
 #include "types.hpp"
 
-#include <map>
-#include <string>
-#include <utility>
+bool search(const pipeline& stages, search_context& context,
+    match_data& data, edit_log& replacements);
+// Drops the range just searched, along with any strings in matches that
+// only it was using, and moves on to the next one.
+// Returns false once there are no ranges left.
+bool next_range(match_data& data);
 
-bool search(match_data& data,
-    std::map<std::pair<std::size_t, std::size_t>, std::string>& replacements);
+// Searches [data._first, data._second) until on_match returns true.
+// on_match is called after each successful search with the edits that
+// search made, which are lost unless it keeps them.
+template<typename on_match_t>
+void search_buffer(const pipeline& stages, search_context& context,
+    match_data& data, edit_log& replacements, on_match_t&& on_match)
+{
+    bool finished = false;
+
+    data._lines.reset(data._first, data._second);
+    data._tokens.reset(data._first, data._second);
+    data._condition_cache.reset(data._first, data._second);
+
+    do
+    {
+        replacements.clear();
+
+        if (search(stages, context, data, replacements))
+            finished = on_match(replacements);
+        else
+            data._negate = false;
+    } while (next_range(data) && !finished);
+}
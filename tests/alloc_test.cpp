@@ -0,0 +1,155 @@
+// Checks that searching a file does not touch the heap once the per
+// thread state has warmed up (see arena.hpp).
+// Grammar stages are not covered, as parsertl allocates its own parse
+// stacks and productions.
+
+#include "../arena.hpp"
+#include "../posix_regex.hpp"
+#include "../scan.hpp"
+#include "../search.hpp"
+#include "../types.hpp"
+
+#include <lexertl/generator.hpp>
+#include <boost/regex.hpp>
+#include <lexertl/rules.hpp>
+
+#include <cstddef>
+#include <cstdlib>
+#include <format>
+#include <iostream>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+static std::size_t g_allocations = 0;
+
+void* operator new(std::size_t size)
+{
+    ++g_allocations;
+
+    if (void* ptr = std::malloc(size ? size : 1))
+        return ptr;
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+// Searches text as search_data() in main.cpp does, counting the hits
+// rather than outputting them.
+static std::size_t search_file(const pipeline& stages,
+    search_context& context, search_arena& arena, const std::string& text)
+{
+    arena.reset();
+
+    match_data data(arena.resource());
+    edit_log replacements(arena.resource());
+    std::size_t hits = 0;
+
+    data._first = text.c_str();
+    data._second = data._first + text.size();
+    data._ranges.emplace_back(data._first, data._first, data._second);
+    search_buffer(stages, context, data, replacements,
+        [&hits](edit_log&)
+        {
+            ++hits;
+            return false;
+        });
+    return hits;
+}
+
+static pipeline text_stage()
+{
+    text t;
+
+    t._text = "needle";
+    t._scanner.emplace(t._text, false);
+
+    pipeline stages;
+
+    stages.emplace_back(std::move(t));
+    return stages;
+}
+
+// ECMAScript, so searched for by boost, with a condition (a DFA)
+static pipeline boost_stage()
+{
+    regex r;
+
+    r._rx.assign(R"(needle_\d+)");
+    r._conditions.emplace(static_cast<uint16_t>(0), condition("[13579]"));
+
+    pipeline stages;
+
+    stages.emplace_back(std::move(r));
+    return stages;
+}
+
+// egrep, so searched for with a DFA (as queue_regex() in main.cpp)
+static pipeline dfa_stage()
+{
+    // Use the lexertl enum operator
+    using namespace lexertl;
+    const std::string rx = "needle_[0-9]+";
+    std::string dfa_rx;
+    regex r;
+    lexertl::rules rules;
+
+    r._flags = *config_flags::egrep;
+    r._rx.assign(rx, boost::regex_constants::egrep);
+    posix_to_lexertl(rx, true, dfa_rx);
+    rules.push(dfa_rx, 1);
+    rules.push("(?s:.)", lexertl::rules::skip());
+    lexertl::generator::build(rules, r._sm);
+    r._scanner = start_scanner(r._sm, false);
+
+    pipeline stages;
+
+    stages.emplace_back(std::move(r));
+    return stages;
+}
+
+int main()
+{
+    std::string text;
+
+    for (std::size_t idx = 0; idx < 1000; ++idx)
+    {
+        text += std::format("int value_{0} = needle_{0}; // haystack\n", idx);
+    }
+
+    const std::pair<const char*, pipeline> tests[] =
+    {
+        { "text", text_stage() },
+        { "boost regex", boost_stage() },
+        { "DFA regex", dfa_stage() }
+    };
+    search_context context;
+    search_arena arena;
+    bool failed = false;
+
+    for (const auto& [name, stages] : tests)
+    {
+        // The first search warms up anything allocated once per thread
+        search_file(stages, context, arena, text);
+
+        const std::size_t before = g_allocations;
+        const std::size_t hits = search_file(stages, context, arena, text);
+        const std::size_t allocations = g_allocations - before;
+
+        std::cout << std::format("{}: {} hits, {} heap allocations\n",
+            name, hits, allocations);
+        failed |= hits == 0 || allocations != 0;
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,158 @@
+#include "pch.h"
+
+#include "thread_pool.hpp"
+
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+static thread_local const thread_pool* t_pool = nullptr;
+static thread_local std::size_t t_index = std::string::npos;
+
+thread_pool::thread_pool(const std::size_t threads)
+{
+    const std::size_t count = threads ? threads : 1;
+
+    _queues.reserve(count);
+
+    for (std::size_t idx = 0; idx < count; ++idx)
+        _queues.emplace_back(std::make_unique<queue>());
+
+    _threads.reserve(count);
+
+    for (std::size_t idx = 0; idx < count; ++idx)
+        _threads.emplace_back([this, idx]() { run(idx); });
+}
+
+thread_pool::~thread_pool()
+{
+    {
+        std::scoped_lock lock(_mutex);
+
+        _stop = true;
+    }
+
+    _cv.notify_all();
+
+    for (auto& thread : _threads)
+        thread.join();
+}
+
+void thread_pool::submit(task t)
+{
+    // Workers keep their own work local, everyone else round robins
+    const std::size_t index = t_pool == this ?
+        t_index :
+        _next++ % _queues.size();
+
+    {
+        std::scoped_lock lock(_queues[index]->_mutex);
+
+        _queues[index]->_tasks.push_back(std::move(t));
+    }
+
+    {
+        std::scoped_lock lock(_mutex);
+
+        ++_queued;
+        ++_pending;
+    }
+
+    _cv.notify_one();
+}
+
+void thread_pool::wait()
+{
+    std::unique_lock lock(_mutex);
+
+    _done_cv.wait(lock, [this]() { return _pending == 0; });
+
+    if (_exception)
+        std::rethrow_exception(std::exchange(_exception, nullptr));
+}
+
+std::size_t thread_pool::worker_index()
+{
+    return t_index;
+}
+
+void thread_pool::run(const std::size_t index)
+{
+    t_pool = this;
+    t_index = index;
+
+    for (;;)
+    {
+        task t;
+        bool failed = false;
+
+        {
+            std::unique_lock lock(_mutex);
+
+            _cv.wait(lock, [this]() { return _stop || _queued; });
+
+            if (!_queued)
+                return;
+
+            // Claim a task. It is guaranteed to be in one of the deques,
+            // although another worker may beat us to the first one we see.
+            --_queued;
+            failed = _exception != nullptr;
+        }
+
+        while (!try_pop(index, t))
+            std::this_thread::yield();
+
+        try
+        {
+            // Once a task has thrown, drain the remaining work unrun
+            if (!failed)
+                t();
+        }
+        catch (...)
+        {
+            std::scoped_lock lock(_mutex);
+
+            if (!_exception)
+                _exception = std::current_exception();
+        }
+
+        std::scoped_lock lock(_mutex);
+
+        if (--_pending == 0)
+            _done_cv.notify_all();
+    }
+}
+
+bool thread_pool::try_pop(const std::size_t index, task& t)
+{
+    {
+        queue& own = *_queues[index];
+        std::scoped_lock lock(own._mutex);
+
+        if (!own._tasks.empty())
+        {
+            t = std::move(own._tasks.back());
+            own._tasks.pop_back();
+            return true;
+        }
+    }
+
+    for (std::size_t idx = 1, size = _queues.size(); idx < size; ++idx)
+    {
+        queue& victim = *_queues[(index + idx) % size];
+        std::scoped_lock lock(victim._mutex);
+
+        if (!victim._tasks.empty())
+        {
+            t = std::move(victim._tasks.front());
+            victim._tasks.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Work stealing thread pool.
+// Each worker owns a deque of tasks. Tasks submitted by a worker go on
+// the back of its own deque and are popped LIFO (keeping directory
+// traversal depth first and cache warm); idle workers steal from the
+// front of the other deques.
+class thread_pool
+{
+public:
+    using task = std::function<void()>;
+
+    explicit thread_pool(const std::size_t threads);
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+    ~thread_pool();
+
+    void submit(task t);
+    // Blocks until every submitted task (including tasks submitted
+    // by other tasks) has run, then rethrows the first exception.
+    void wait();
+
+    std::size_t size() const
+    {
+        return _threads.size();
+    }
+
+    // Index of the calling worker, or npos if not a worker.
+    static std::size_t worker_index();
+
+private:
+    struct queue
+    {
+        std::mutex _mutex;
+        std::deque<task> _tasks;
+    };
+
+    std::vector<std::unique_ptr<queue>> _queues;
+    std::vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::condition_variable _done_cv;
+    // Tasks sitting in a deque and not yet claimed by a worker
+    std::size_t _queued = 0;
+    // Tasks submitted but not yet finished
+    std::size_t _pending = 0;
+    std::atomic<std::size_t> _next = 0;
+    bool _stop = false;
+    std::exception_ptr _exception;
+
+    void run(const std::size_t index);
+    bool try_pop(const std::size_t index, task& t);
+};
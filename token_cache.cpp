@@ -0,0 +1,141 @@
+#include "pch.h"
+
+#include "token_cache.hpp"
+
+#include <lexertl/iterator.hpp>
+#include <lexertl/state_machine.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <memory_resource>
+
+// Tokens before a reused position are dropped once there are this many
+static constexpr std::size_t g_compact_threshold = 4096;
+
+void token_stream::start(const lexertl::state_machine& sm, const char* first,
+    const char* eoi)
+{
+    _sm = &sm;
+    _eoi = eoi;
+    _tokens.clear();
+    _lexer = lexertl::criterator(first, eoi, sm);
+    _tokens.push_back({ _lexer->id, _lexer->user_id, 0, _lexer->state,
+        _lexer->bol, _lexer->first, _lexer->second });
+}
+
+void token_stream::extend()
+{
+    const id_type start_state = _tokens.back()._state;
+
+    if (_tokens.back()._id == 0)
+        return;
+
+    ++_lexer;
+    _tokens.push_back({ _lexer->id, _lexer->user_id, start_state,
+        _lexer->state, _lexer->bol, _lexer->first, _lexer->second });
+}
+
+token_iterator::token_iterator(token_stream& stream, const std::size_t index) :
+    _stream(&stream),
+    _index(index)
+{
+    _results.eoi = stream._eoi;
+    load();
+}
+
+token_iterator& token_iterator::operator++()
+{
+    // Stay on end of input, as lexertl does
+    if (_stream->_tokens[_index]._id != 0)
+    {
+        ++_index;
+
+        if (_index == _stream->_tokens.size())
+            _stream->extend();
+
+        load();
+    }
+
+    return *this;
+}
+
+token_iterator token_iterator::operator++(int)
+{
+    token_iterator iter(*this);
+
+    ++*this;
+    return iter;
+}
+
+void token_iterator::load()
+{
+    const token_stream::token& token = _stream->_tokens[_index];
+
+    _results.id = token._id;
+    _results.user_id = token._user_id;
+    _results.first = token._first;
+    _results.second = token._second;
+    _results.bol = token._bol;
+    _results.state = token._state;
+}
+
+token_cache::token_cache(std::pmr::memory_resource* resource) :
+    _streams(resource)
+{
+}
+
+void token_cache::reset(const char* first, const char* second)
+{
+    _first = first;
+    _second = second;
+
+    for (auto& stream : _streams)
+    {
+        stream._eoi = nullptr;
+        stream._tokens.clear();
+    }
+}
+
+token_iterator token_cache::begin(const lexertl::state_machine& sm,
+    const char* first, const char* eoi)
+{
+    auto iter = std::ranges::find(_streams, &sm, &token_stream::_sm);
+
+    if (iter == _streams.end())
+        iter = _streams.emplace(_streams.end(),
+            _streams.get_allocator().resource());
+
+    token_stream& stream = *iter;
+
+    // Text produced by grammar actions can reuse the addresses of earlier
+    // text, so only tokens from the buffer itself are kept.
+    if (stream._sm == &sm && stream._eoi == eoi &&
+        first >= _first && eoi <= _second && !stream._tokens.empty() &&
+        stream._tokens.front()._first <= first)
+    {
+        auto& tokens = stream._tokens;
+
+        while (tokens.back()._first < first && tokens.back()._id != 0)
+            stream.extend();
+
+        auto tok = std::ranges::lower_bound(tokens, first,
+            {}, &token_stream::token::_first);
+
+        if (tok != tokens.end() && tok->_first == first &&
+            tok->_start_state == 0)
+        {
+            std::size_t index = tok - tokens.begin();
+
+            if (index >= g_compact_threshold && index * 2 >= tokens.size())
+            {
+                tokens.erase(tokens.begin(), tok);
+                index = 0;
+            }
+
+            return token_iterator(stream, index);
+        }
+    }
+
+    stream.start(sm, first, eoi);
+    return token_iterator(stream, 0);
+}
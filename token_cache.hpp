@@ -0,0 +1,117 @@
+#pragma once
+
+#include <lexertl/iterator.hpp>
+#include <lexertl/state_machine.hpp>
+
+#include <cstddef>
+#include <deque>
+#include <iterator>
+#include <memory_resource>
+#include <vector>
+
+class token_cache;
+
+// The tokens lexed from one position by one lexer.
+// Tokens are lexed on demand and kept, so that moving over them again
+// (a grammar search restarting at the next token, or the next search
+// starting where the last match ended) does not run the DFA again.
+struct token_stream
+{
+    using results = lexertl::criterator::value_type;
+    using id_type = results::id_type;
+
+    struct token
+    {
+        id_type _id = 0;
+        id_type _user_id = 0;
+        // Lexer state before and after the token
+        id_type _start_state = 0;
+        id_type _state = 0;
+        bool _bol = false;
+        const char* _first = nullptr;
+        const char* _second = nullptr;
+    };
+
+    const lexertl::state_machine* _sm = nullptr;
+    const char* _eoi = nullptr;
+    std::pmr::vector<token> _tokens;
+    // Positioned at _tokens.back()
+    lexertl::criterator _lexer;
+
+    explicit token_stream(std::pmr::memory_resource* resource) :
+        _tokens(resource)
+    {
+    }
+
+    void start(const lexertl::state_machine& sm, const char* first,
+        const char* eoi);
+    // Lexes the next token (unless the end has been reached).
+    void extend();
+};
+
+// Drop in replacement for lexertl::criterator that reads a token_stream.
+class token_iterator
+{
+public:
+    using value_type = token_stream::results;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const value_type*;
+    using reference = const value_type&;
+    using iterator_category = std::forward_iterator_tag;
+
+    token_iterator() = default;
+
+    reference operator*() const
+    {
+        return _results;
+    }
+
+    pointer operator->() const
+    {
+        return &_results;
+    }
+
+    token_iterator& operator++();
+    token_iterator operator++(int);
+
+    bool operator==(const token_iterator& rhs) const
+    {
+        return _stream == rhs._stream && _index == rhs._index;
+    }
+
+    bool operator!=(const token_iterator& rhs) const
+    {
+        return !(*this == rhs);
+    }
+
+private:
+    friend class token_cache;
+
+    token_stream* _stream = nullptr;
+    std::size_t _index = 0;
+    value_type _results;
+
+    token_iterator(token_stream& stream, const std::size_t index);
+    void load();
+};
+
+// The token streams for the parser stages searching one buffer (a file,
+// or a window of it with --stream). A stream is reused when a search
+// starts on a token boundary already lexed (in the initial lexer state),
+// and is otherwise restarted.
+class token_cache
+{
+public:
+    explicit token_cache(std::pmr::memory_resource* resource);
+
+    // Call whenever the buffer being searched changes.
+    void reset(const char* first, const char* second);
+    token_iterator begin(const lexertl::state_machine& sm, const char* first,
+        const char* eoi);
+
+private:
+    const char* _first = nullptr;
+    const char* _second = nullptr;
+    // One per parser lexer. A deque, as iterators point into the streams.
+    std::pmr::deque<token_stream> _streams;
+};
@@ -0,0 +1,231 @@
+#include "pch.h"
+
+#include "transcode.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GG_SSE2
+#include <emmintrin.h>
+#endif
+
+static constexpr char32_t g_replacement = 0xfffd;
+
+static uint16_t unit(const uint16_t* ptr, const bool flip)
+{
+    const uint16_t c = *ptr;
+
+    return flip ? static_cast<uint16_t>((c >> 8) | (c << 8)) : c;
+}
+
+static bool is_high(const uint16_t c)
+{
+    return c >= 0xd800 && c <= 0xdbff;
+}
+
+static bool is_low(const uint16_t c)
+{
+    return c >= 0xdc00 && c <= 0xdfff;
+}
+
+// Decodes one code point, advancing first
+static char32_t next_utf16(const uint16_t*& first, const uint16_t* second,
+    const bool flip)
+{
+    const uint16_t c = unit(first++, flip);
+
+    if (is_high(c))
+    {
+        if (first != second)
+        {
+            if (const uint16_t l = unit(first, flip); is_low(l))
+            {
+                ++first;
+                return 0x10000 + ((static_cast<char32_t>(c) - 0xd800) << 10) +
+                    (l - 0xdc00);
+            }
+        }
+
+        return g_replacement;
+    }
+    else if (is_low(c))
+        return g_replacement;
+    else
+        return c;
+}
+
+static std::size_t utf8_length(const char32_t c)
+{
+    return c < 0x80 ? 1 : c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+}
+
+static unsigned char* encode_utf8(const char32_t c, unsigned char* out)
+{
+    if (c < 0x80)
+        *out++ = static_cast<unsigned char>(c);
+    else if (c < 0x800)
+    {
+        *out++ = static_cast<unsigned char>(0xc0 | (c >> 6));
+        *out++ = static_cast<unsigned char>(0x80 | (c & 0x3f));
+    }
+    else if (c < 0x10000)
+    {
+        *out++ = static_cast<unsigned char>(0xe0 | (c >> 12));
+        *out++ = static_cast<unsigned char>(0x80 | ((c >> 6) & 0x3f));
+        *out++ = static_cast<unsigned char>(0x80 | (c & 0x3f));
+    }
+    else
+    {
+        *out++ = static_cast<unsigned char>(0xf0 | (c >> 18));
+        *out++ = static_cast<unsigned char>(0x80 | ((c >> 12) & 0x3f));
+        *out++ = static_cast<unsigned char>(0x80 | ((c >> 6) & 0x3f));
+        *out++ = static_cast<unsigned char>(0x80 | (c & 0x3f));
+    }
+
+    return out;
+}
+
+#ifdef GG_SSE2
+// Loads 8 code units, returning false if any are not ASCII
+static bool load_ascii(const uint16_t* ptr, const bool flip, __m128i& units)
+{
+    units = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+
+    if (flip)
+        units = _mm_or_si128(_mm_slli_epi16(units, 8),
+            _mm_srli_epi16(units, 8));
+
+    const __m128i high = _mm_and_si128(units,
+        _mm_set1_epi16(static_cast<short>(0xff80)));
+
+    return _mm_movemask_epi8(_mm_cmpeq_epi16(high,
+        _mm_setzero_si128())) == 0xffff;
+}
+#endif
+
+void utf16_to_utf8(const uint16_t* first, const uint16_t* second,
+    const bool flip, std::vector<unsigned char>& utf8)
+{
+    std::size_t size = 0;
+
+    // Size exactly, so the output is allocated once
+    for (const uint16_t* ptr = first; ptr != second; )
+    {
+#ifdef GG_SSE2
+        __m128i units;
+
+        if (second - ptr >= 8 && load_ascii(ptr, flip, units))
+        {
+            size += 8;
+            ptr += 8;
+            continue;
+        }
+#endif
+
+        size += utf8_length(next_utf16(ptr, second, flip));
+    }
+
+    utf8.resize(size);
+
+    unsigned char* out = utf8.data();
+
+    while (first != second)
+    {
+#ifdef GG_SSE2
+        __m128i units;
+
+        if (second - first >= 8 && load_ascii(first, flip, units))
+        {
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(out),
+                _mm_packus_epi16(units, units));
+            out += 8;
+            first += 8;
+            continue;
+        }
+#endif
+
+        out = encode_utf8(next_utf16(first, second, flip), out);
+    }
+}
+
+// Decodes one code point, advancing first
+static char32_t next_utf8(const unsigned char*& first,
+    const unsigned char* second)
+{
+    const unsigned char c = *first++;
+    std::size_t extra = 0;
+    char32_t cp = 0;
+
+    if (c < 0x80)
+        return c;
+    else if (c >= 0xc2 && c <= 0xdf)
+    {
+        extra = 1;
+        cp = c & 0x1f;
+    }
+    else if (c >= 0xe0 && c <= 0xef)
+    {
+        extra = 2;
+        cp = c & 0x0f;
+    }
+    else if (c >= 0xf0 && c <= 0xf4)
+    {
+        extra = 3;
+        cp = c & 0x07;
+    }
+    else
+        return g_replacement;
+
+    for (; extra; --extra)
+    {
+        if (first == second || (*first & 0xc0) != 0x80)
+            return g_replacement;
+
+        cp = (cp << 6) | (*first++ & 0x3f);
+    }
+
+    // Reject surrogates and out of range values
+    if ((cp >= 0xd800 && cp <= 0xdfff) || cp > 0x10ffff)
+        return g_replacement;
+
+    return cp;
+}
+
+void utf8_to_utf16(const std::string_view& utf8, const bool flip,
+    std::vector<uint16_t>& utf16)
+{
+    auto first = reinterpret_cast<const unsigned char*>(utf8.data());
+    const unsigned char* second = first + utf8.size();
+    const std::size_t start = utf16.size();
+    auto put = [flip](const char32_t c)
+        {
+            const auto u = static_cast<uint16_t>(c);
+
+            return flip ? static_cast<uint16_t>((u >> 8) | (u << 8)) : u;
+        };
+
+    // UTF-16 never needs more code units than UTF-8 needs bytes
+    utf16.resize(start + utf8.size());
+
+    uint16_t* out = utf16.data() + start;
+
+    while (first != second)
+    {
+        if (*first < 0x80)
+        {
+            *out++ = put(*first++);
+            continue;
+        }
+
+        const char32_t c = next_utf8(first, second);
+
+        if (c >= 0x10000)
+        {
+            *out++ = put(0xd800 + ((c - 0x10000) >> 10));
+            *out++ = put(0xdc00 + ((c - 0x10000) & 0x3ff));
+        }
+        else
+            *out++ = put(c);
+    }
+
+    utf16.resize(out - utf16.data());
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Bulk UTF-16 <-> UTF-8 conversion.
+// flip indicates UTF-16 with the opposite byte order to the host
+// (a 0xfffe BOM). Unpaired surrogates and invalid UTF-8 are replaced
+// with U+FFFD.
+
+// Converts [first, second) to UTF-8, sizing utf8 exactly in advance.
+void utf16_to_utf8(const uint16_t* first, const uint16_t* second,
+    const bool flip, std::vector<unsigned char>& utf8);
+// Appends utf8 converted to UTF-16 to utf16.
+void utf8_to_utf16(const std::string_view& utf8, const bool flip,
+    std::vector<uint16_t>& utf16);
@@ -1,5 +1,6 @@
 #include "pch.h"
 
+#include "config_cache.hpp"
 #include "gg_error.hpp"
 #include "output.hpp"
 #include "parser.hpp"
@@ -19,13 +20,16 @@
 
 #include <algorithm>
 #include <array>
+#include <cstdint>
 #include <cstdio>
 #include <exception>
 #include <format>
 #include <iostream>
 #include <memory>
+#include <optional>
 #include <set>
 #include <string>
+#include <string_view>
 #include <vector>
 
 extern options g_options;
@@ -65,18 +69,8 @@ static std::string replace_captures(const std::string& text,
     const std::vector<std::string>& productions)
 {
     std::string ret;
-    static lexertl::state_machine cap_sm;
-
-    if (cap_sm.empty())
-    {
-        lexertl::rules rules;
-
-        rules.push(R"(\$\d)", 1);
-        lexertl::generator::build(rules, cap_sm);
-    }
-
     auto i = lexertl::citerator(text.c_str(),
-        text.c_str() + text.size(), cap_sm);
+        text.c_str() + text.size(), capture_lexer());
     lexertl::citerator e;
 
     for (; i != e; ++i)
@@ -99,17 +93,24 @@ static std::string replace_captures(const std::string& text,
 
 std::string actions::exec(cmd* command,
     const std::vector<std::string>& productions,
-    std::map<std::string, std::string, std::less<>>* vars)
+    std::map<std::string, std::string, std::less<>>* vars,
+    exec_state& state) const
 {
     std::string output;
-    std::vector<cmd_data> stack;
+    auto& cmd_stack = state._cmd_stack;
+    auto& index_stack = state._index_stack;
+    auto& stack = state._stack;
+
+    cmd_stack.clear();
+    index_stack.clear();
+    stack.clear();
 
     if (command)
-        _cmd_stack.push_back(command);
+        cmd_stack.push_back(command);
 
-    while (!_cmd_stack.empty())
+    while (!cmd_stack.empty())
     {
-        command = _cmd_stack.back();
+        command = cmd_stack.back();
 
         switch (command->_type)
         {
@@ -117,14 +118,14 @@ std::string actions::exec(cmd* command,
         {
             auto ptr = static_cast<format_cmd*>(command);
 
-            _index_stack.insert(_index_stack.end(), ptr->_params.size(),
+            index_stack.insert(index_stack.end(), ptr->_params.size(),
                 stack.size());
             stack.emplace_back(ptr->_type, ptr->_params.size());
 
             for (auto iter = ptr->_params.rbegin(), end = ptr->_params.rend();
                 iter != end; ++iter)
             {
-                _cmd_stack.push_back(*iter);
+                cmd_stack.push_back(*iter);
             }
 
             break;
@@ -144,17 +145,17 @@ std::string actions::exec(cmd* command,
             }
             else
             {
-                const auto idx = _index_stack.back();
+                const auto idx = index_stack.back();
 
                 if (idx >= stack.size())
                     throw gg_error(std::format("Index ${} is out of range", idx));
 
                 stack[idx]._params.
                     push_back(productions[ptr->_param1]);
-                _index_stack.pop_back();
+                index_stack.pop_back();
             }
 
-            _cmd_stack.pop_back();
+            cmd_stack.pop_back();
             break;
         }
         case cmd::type::print:
@@ -162,19 +163,19 @@ std::string actions::exec(cmd* command,
             auto ptr = static_cast<print_cmd*>(command);
 
             // print() doesn't return anything, so pop
-            _cmd_stack.pop_back();
-            _cmd_stack.push_back(ptr->_param);
+            cmd_stack.pop_back();
+            cmd_stack.push_back(ptr->_param);
             break;
         }
         case cmd::type::replace_all:
         {
             auto ptr = static_cast<replace_all_cmd*>(command);
 
-            _index_stack.insert(_index_stack.end(), 3, stack.size());
+            index_stack.insert(index_stack.end(), 3, stack.size());
             stack.emplace_back(ptr->_type, 3);
-            _cmd_stack.push_back(ptr->_params[2]);
-            _cmd_stack.push_back(ptr->_params[1]);
-            _cmd_stack.push_back(ptr->_params[0]);
+            cmd_stack.push_back(ptr->_params[2]);
+            cmd_stack.push_back(ptr->_params[1]);
+            cmd_stack.push_back(ptr->_params[0]);
             break;
         }
         case cmd::type::string:
@@ -189,11 +190,11 @@ std::string actions::exec(cmd* command,
             }
             else
             {
-                stack[_index_stack.back()]._params.push_back(std::move(str));
-                _index_stack.pop_back();
+                stack[index_stack.back()]._params.push_back(std::move(str));
+                index_stack.pop_back();
             }
 
-            _cmd_stack.pop_back();
+            cmd_stack.pop_back();
             break;
         }
         case cmd::type::var:
@@ -207,12 +208,12 @@ std::string actions::exec(cmd* command,
             }
             else
             {
-                stack[_index_stack.back()]._params.
+                stack[index_stack.back()]._params.
                     push_back((*vars)[ptr->_name]);
-                _index_stack.pop_back();
+                index_stack.pop_back();
             }
 
-            _cmd_stack.pop_back();
+            cmd_stack.pop_back();
             break;
         }
         case cmd::type::capitalise:
@@ -222,9 +223,9 @@ std::string actions::exec(cmd* command,
         {
             auto ptr = static_cast<param_cmd*>(command);
 
-            _index_stack.push_back(stack.size());
+            index_stack.push_back(stack.size());
             stack.emplace_back(ptr->_type, 1);
-            _cmd_stack.push_back(ptr->_param);
+            cmd_stack.push_back(ptr->_param);
             break;
         }
         default:
@@ -236,16 +237,16 @@ std::string actions::exec(cmd* command,
             // Execute command
             output = stack.back().run(vars);
 
-            if (!_index_stack.empty())
+            if (!index_stack.empty())
             {
-                stack[_index_stack.back()]._params.push_back(output);
-                _index_stack.pop_back();
+                stack[index_stack.back()]._params.push_back(output);
+                index_stack.pop_back();
             }
 
             stack.pop_back();
 
-            if (!_cmd_stack.empty())
-                _cmd_stack.pop_back();
+            if (!cmd_stack.empty())
+                cmd_stack.pop_back();
         }
     }
 
@@ -277,7 +278,7 @@ std::string cmd_data::run(std::map<std::string,
             auto iter = _params.begin();
             auto fmt_iter = iter;
             auto end = _params.end();
-            const auto [gsm, lsm] = param_parser();
+            const auto& [gsm, lsm] = param_parser();
             lexertl::citerator liter(iter->c_str(),
                 iter->c_str() + iter->size(), lsm);
             parsertl::csearch_iterator giter(liter, gsm);
@@ -445,6 +446,19 @@ void config_state::parse(const unsigned int flags,
             column));
     }
 
+    std::optional<config_cache> cache;
+    bool cached = false;
+    std::string warnings;
+
+    if (!g_options._cache_dir.empty())
+    {
+        cache.emplace(g_options._cache_dir, _mf.data(),
+            _mf.data() + _mf.size(), flags);
+        cached = g_options._force_unicode ?
+            cache->load(g_curr_uparser->_gsm, g_curr_uparser->_lsm, warnings) :
+            cache->load(g_curr_parser->_gsm, g_curr_parser->_lsm, warnings);
+    }
+
     _mf.close();
 
     if (_grules.grammar().empty())
@@ -460,7 +474,6 @@ void config_state::parse(const unsigned int flags,
     }
     else
     {
-        std::string warnings;
         parsertl::rules::string_vector terminals;
         const auto& grammar = _grules.grammar();
         const auto& ids = g_options._force_unicode ?
@@ -469,12 +482,15 @@ void config_state::parse(const unsigned int flags,
         std::set<std::size_t> used_tokens;
         std::set<std::size_t> used_prec;
 
-        if (g_options._force_unicode)
-            parsertl::generator::build(_grules, g_curr_uparser->_gsm,
-                &warnings);
-        else
-            parsertl::generator::build(_grules, g_curr_parser->_gsm,
-                &warnings);
+        if (!cached)
+        {
+            if (g_options._force_unicode)
+                parsertl::generator::build(_grules, g_curr_uparser->_gsm,
+                    &warnings);
+            else
+                parsertl::generator::build(_grules, g_curr_parser->_gsm,
+                    &warnings);
+        }
 
         _grules.terminals(terminals);
 
@@ -545,6 +561,9 @@ void config_state::parse(const unsigned int flags,
         }
     }
 
+    if (cached)
+        return;
+
     if (g_options._force_unicode)
     {
         using rules_type = lexertl::basic_rules<char, char32_t>;
@@ -552,7 +571,43 @@ void config_state::parse(const unsigned int flags,
             lexertl::u32state_machine>;
 
         generator::build(_lurules, g_curr_uparser->_lsm);
+
+        if (cache)
+            cache->save(g_curr_uparser->_gsm, g_curr_uparser->_lsm, warnings);
     }
     else
+    {
         lexertl::generator::build(_lrules, g_curr_parser->_lsm);
+
+        if (cache)
+            cache->save(g_curr_parser->_gsm, g_curr_parser->_lsm, warnings);
+    }
+}
+
+static char fold(const char c)
+{
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+std::size_t word_hash::operator()(const std::string_view& word) const
+{
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (const char c : word)
+    {
+        hash ^= static_cast<unsigned char>(_icase ? fold(c) : c);
+        hash *= 0x100000001b3ULL;
+    }
+
+    return static_cast<std::size_t>(hash);
+}
+
+bool word_equal::operator()(const std::string_view& lhs,
+    const std::string_view& rhs) const
+{
+    if (!_icase)
+        return lhs == rhs;
+
+    return std::ranges::equal(lhs, rhs, {}, fold, fold);
 }
@@ -1,5 +1,12 @@
 #pragma once
 
+#include "condition.hpp"
+#include "edit_log.hpp"
+#include "glob_set.hpp"
+#include "line_index.hpp"
+#include "scan.hpp"
+#include "token_cache.hpp"
+
 #include <lexertl/iterator.hpp>
 #include <parsertl/iterator.hpp>
 #include <lexertl/match_results.hpp>
@@ -15,14 +22,18 @@
 #include <wildcardtl/wildcard.hpp>
 
 #include <cstdint>
+#include <deque>
 #include <functional>
 #include <map>
 #include <memory>
+#include <memory_resource>
+#include <optional>
 #include <set>
 #include <stack>
 #include <string>
 #include <string_view>
 #include <type_traits>
+#include <unordered_set>
 #include <utility>
 #include <variant>
 #include <vector>
@@ -38,7 +49,8 @@ enum class config_flags
     extend_search = 32,
     ret_prev_match = 64,
     grep = 128,
-    egrep = 256
+    egrep = 256,
+    single_pass = 512
 };
 
 enum class show_filename
@@ -48,7 +60,7 @@ enum class show_filename
     yes
 };
 
-using condition_map = std::map<uint16_t, boost::regex>;
+using condition_map = std::map<uint16_t, condition>;
 
 struct wildcards
 {
@@ -60,6 +72,17 @@ struct wildcards
 
     std::vector<wildcard> _positive;
     std::vector<wildcard> _negative;
+    // The same patterns for matching in a single pass.
+    // _negative_set is only filled in where a path is tested against
+    // any (rather than all) of the negative patterns.
+    glob_set _positive_set;
+    glob_set _negative_set;
+
+    void build()
+    {
+        _positive_set.build();
+        _negative_set.build();
+    }
 };
 
 enum class binary_files
@@ -97,7 +120,12 @@ struct options
     std::size_t _after_context = 0;
     std::size_t _before_context = 0;
     binary_files _binary_files = binary_files::binary;
+    // Bytes checked for NUL by fetch_file_type() (0 for all)
+    std::size_t _binary_probe = 32 * 1024;
+    // Trigram index to update (--build-index)
+    std::string _build_index;
     bool _byte_offset = false;
+    std::string _cache_dir;
     std::string _checkout;
     bool _colour = false;
     condition_map _conditions;
@@ -112,6 +140,8 @@ struct options
     bool _follow_symlinks = false;
     bool _force_unicode = false;
     bool _force_write = false;
+    // Skip whatever .gitignore and .ignore files list
+    bool _gitignore = false;
     bool _hit_separator = false;
     bool _initial_tab = false;
     std::string _label;
@@ -121,6 +151,9 @@ struct options
     bool _modify = false; // Set when grammar has modifying operations
     bool _no_messages = false;
     bool _only_matching = false;
+    // Consecutive flex patterns are alternatives rather than chained
+    bool _or = false;
+    bool _ordered = false;
     pathname_only _pathname_only = pathname_only::no;
     // maps path to wildcards.
     std::map<std::string, wildcards, std::less<>> _pathnames;
@@ -139,7 +172,12 @@ struct options
     bool _show_version = false;
     std::string _shutdown;
     std::string _startup;
+    // Window size for --stream (0 to read input in one go)
+    std::size_t _stream = 0;
     bool _summary = false;
+    std::size_t _threads = 1;
+    // Trigram index to filter files with (--use-index)
+    std::string _use_index;
     bool _whole_match = false;
     std::vector<lexertl::memory_file> _word_list_files;
     bool _writable = false;
@@ -169,16 +207,24 @@ struct match_type_base
 struct text : match_type_base
 {
     std::string _text;
+    // Not set if _text references captures
+    std::optional<text_scanner> _scanner;
 };
 
 struct regex : match_type_base
 {
     boost::regex _rx;
+    // Empty unless _rx can be searched for as a DFA (see posix_regex.hpp),
+    // in which case _rx is only used to extract captures.
+    lexertl::state_machine _sm;
+    byte_scanner _scanner;
 };
 
 struct lexer : match_type_base
 {
     lexertl::state_machine _sm;
+    // Skips bytes that cannot start a match
+    byte_scanner _scanner;
 };
 
 struct ulexer : match_type_base
@@ -455,12 +501,22 @@ struct cmd_data
     std::string run(std::map<std::string, std::string, std::less<>>* vars) const;
 };
 
+// Scratch space for actions::exec().
+// Owned by the caller so that compiled actions can be shared
+// between threads.
+struct exec_state
+{
+    std::vector<cmd*> _cmd_stack;
+    std::vector<std::size_t> _index_stack;
+    std::vector<cmd_data> _stack;
+};
+
 struct actions
 {
     std::vector<std::shared_ptr<cmd>> _storage;
     std::vector<cmd*> _commands;
+    // Only used whilst building the actions
     std::vector<cmd*> _cmd_stack;
-    std::vector<std::size_t> _index_stack;
 
     void emplace(std::shared_ptr<cmd> command)
     {
@@ -485,7 +541,8 @@ struct actions
     }
 
     std::string exec(cmd* command, const std::vector<std::string>& productions,
-        std::map<std::string, std::string, std::less<>>* vars);
+        std::map<std::string, std::string, std::less<>>* vars,
+        exec_state& state) const;
 };
 
 struct parser_base : match_type_base
@@ -498,6 +555,8 @@ struct parser_base : match_type_base
 struct parser : parser_base
 {
     lexertl::state_machine _lsm;
+    // Skips bytes that cannot start a match
+    byte_scanner _scanner;
 };
 
 struct uparser : parser_base
@@ -505,9 +564,26 @@ struct uparser : parser_base
     lexertl::u32state_machine _lsm;
 };
 
+// Hash and equality for word_list, optionally ignoring (ASCII) case
+struct word_hash
+{
+    bool _icase = false;
+
+    std::size_t operator()(const std::string_view& word) const;
+};
+
+struct word_equal
+{
+    bool _icase = false;
+
+    bool operator()(const std::string_view& lhs,
+        const std::string_view& rhs) const;
+};
+
 struct word_list : match_type_base
 {
-    std::vector<std::string_view> _list;
+    // Views into the word list file
+    std::unordered_set<std::string_view, word_hash, word_equal> _words;
 };
 
 enum class match_type
@@ -615,8 +691,25 @@ struct match
     }
 };
 
-using capture_vector = std::vector<std::vector<std::string_view>>;
+using capture_vector =
+    std::pmr::vector<std::pmr::vector<std::string_view>>;
+using match_vector = std::pmr::vector<match>;
+using match_stack =
+    std::stack<std::pmr::string, std::pmr::deque<std::pmr::string>>;
 
+// Per thread mutable state used when searching with a shared,
+// read only pipeline.
+struct search_context
+{
+    exec_state _exec;
+    // Script parameters, reused between matches
+    std::vector<std::string> _productions;
+    std::size_t _files = 0;
+    std::size_t _hits = 0;
+    std::size_t _searched = 0;
+};
+
+// The containers are allocated from a per file resource (see arena.hpp).
 struct match_data
 {
     bool _negate = false;
@@ -626,14 +719,31 @@ struct match_data
     const char* _second = nullptr;
     const char* _curr = nullptr;
     const char* _last = nullptr;
-    std::vector<match> _ranges;
-    std::stack<std::string> _matches;
+    match_vector _ranges;
+    match_stack _matches;
     capture_vector _captures;
     std::size_t _count = 0;
     std::size_t _hits = 0;
-    std::map<std::pair<std::size_t, std::size_t>, std::string> _replacements;
+    edit_log _replacements;
     std::size_t _prev_line = 0;
     std::size_t _curr_line = std::string::npos;
+    line_index _lines;
+    // Lines and bytes preceding _first when streaming
+    std::size_t _line_base = 0;
+    std::size_t _byte_base = 0;
+    // Tokens lexed by parser stages
+    token_cache _tokens;
+    condition_cache _condition_cache;
+
+    explicit match_data(std::pmr::memory_resource* resource) :
+        _ranges(resource),
+        _matches(match_stack::container_type(resource)),
+        _captures(resource),
+        _replacements(resource),
+        _tokens(resource),
+        _condition_cache(resource)
+    {
+    }
 };
 
 using utf8_in_iterator = lexertl::basic_utf8_in_iterator<const char*, char32_t>;
@@ -641,9 +751,4 @@ using utf8_results = lexertl::recursive_match_results<utf8_in_iterator>;
 using crutf8iterator =
 lexertl::iterator<utf8_in_iterator, lexertl::u32state_machine, utf8_results>;
 
-using utf16_in_iterator =
-    lexertl::basic_utf16_in_iterator<const uint16_t*, int32_t>;
-using utf8_out_iterator =
-    lexertl::basic_utf8_out_iterator<utf16_in_iterator>;
-
 [[nodiscard]] std::string exec_ret(const std::string& cmd);
@@ -0,0 +1,164 @@
+#include "pch.h"
+
+#include "walk.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <system_error>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+namespace fs = std::filesystem;
+
+#ifdef _WIN32
+dir_reader::dir_reader(const std::string& path)
+{
+    std::error_code ec;
+
+    _iter = fs::directory_iterator(path,
+        fs::directory_options::skip_permission_denied, ec);
+}
+
+dir_reader::~dir_reader() = default;
+
+bool dir_reader::next(dir_entry& entry)
+{
+    if (_iter == fs::directory_iterator())
+        return false;
+
+    // directory_entry caches what FindNextFile() returned,
+    // so none of this goes back to the file system.
+    const fs::directory_entry& de = *_iter;
+    std::error_code ec;
+
+    // Don't throw if there is a Unicode pathname
+    entry._pathname = reinterpret_cast<const char*>
+        (de.path().u8string().c_str());
+    entry._info = file_info();
+    entry._info._symlink = de.is_symlink(ec);
+
+    if (de.is_directory(ec))
+        entry._info._kind = file_kind::directory;
+    else if (de.is_regular_file(ec))
+    {
+        entry._info._kind = file_kind::file;
+        entry._info._perms = de.status(ec).permissions();
+        entry._info._size = de.file_size(ec);
+        entry._info._mtime =
+            de.last_write_time(ec).time_since_epoch().count();
+    }
+    else
+        entry._info._kind = file_kind::other;
+
+    _iter.increment(ec);
+
+    if (ec)
+        _iter = fs::directory_iterator();
+
+    return true;
+}
+#else
+dir_reader::dir_reader(const std::string& path) :
+    _path(path),
+    _dir(::opendir(path.c_str()))
+{
+    if (!_path.empty() && _path.back() != fs::path::preferred_separator)
+        _path += fs::path::preferred_separator;
+}
+
+dir_reader::~dir_reader()
+{
+    if (_dir)
+        ::closedir(_dir);
+}
+
+bool dir_reader::next(dir_entry& entry)
+{
+    if (!_dir)
+        return false;
+
+    while (const dirent* de = ::readdir(_dir))
+    {
+        const char* name = de->d_name;
+
+        if (name[0] == '.' &&
+            (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+        {
+            continue;
+        }
+
+        entry._pathname.assign(_path).append(name);
+        entry._info = file_info();
+
+#ifdef DT_UNKNOWN
+        switch (de->d_type)
+        {
+        case DT_DIR:
+            entry._info._kind = file_kind::directory;
+            break;
+        case DT_REG:
+            stat_at(name, 0, entry._info);
+            break;
+        case DT_LNK:
+            entry._info._symlink = true;
+            stat_at(name, 0, entry._info);
+            break;
+        case DT_UNKNOWN:
+            stat_at(name, AT_SYMLINK_NOFOLLOW, entry._info);
+            break;
+        default:
+            entry._info._kind = file_kind::other;
+            break;
+        }
+#else
+        stat_at(name, AT_SYMLINK_NOFOLLOW, entry._info);
+#endif
+
+        return true;
+    }
+
+    return false;
+}
+
+void dir_reader::stat_at(const char* name, const int flags,
+    file_info& info) const
+{
+    struct stat st {};
+
+    // A dangling link or a file deleted under us stays file_kind::none
+    if (::fstatat(::dirfd(_dir), name, &st, flags) != 0)
+        return;
+
+    if (S_ISLNK(st.st_mode))
+    {
+        info._symlink = true;
+
+        if (::fstatat(::dirfd(_dir), name, &st, 0) != 0)
+            return;
+    }
+
+    if (S_ISDIR(st.st_mode))
+        info._kind = file_kind::directory;
+    else if (S_ISREG(st.st_mode))
+    {
+        info._kind = file_kind::file;
+        // The permission bits are the same as std::filesystem::perms
+        info._perms = static_cast<fs::perms>(st.st_mode & 07777);
+        info._size = static_cast<std::uintmax_t>(st.st_size);
+        // st_blocks counts 512 byte units
+        info._sparse = st.st_blocks * 512 < st.st_size;
+#ifdef __APPLE__
+        info._mtime = st.st_mtimespec.tv_sec * 1000000000LL +
+            st.st_mtimespec.tv_nsec;
+#else
+        info._mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+    }
+    else
+        info._kind = file_kind::other;
+}
+#endif
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+#ifndef _WIN32
+#include <dirent.h>
+#endif
+
+enum class file_kind
+{
+    none, file, directory, other
+};
+
+// What the directory walk learns about an entry. Passed on to the search
+// so that nothing needs to be stat'ed twice.
+struct file_info
+{
+    // Of the target if the entry is a symbolic link
+    file_kind _kind = file_kind::none;
+    bool _symlink = false;
+    // Only filled in for files
+    std::filesystem::perms _perms = std::filesystem::perms::unknown;
+    std::uintmax_t _size = 0;
+    // Last write time, in platform specific units
+    std::int64_t _mtime = 0;
+    // Fewer blocks allocated than the size needs (holes or compression)
+    bool _sparse = false;
+};
+
+struct dir_entry
+{
+    std::string _pathname;
+    file_info _info;
+};
+
+// Reads a directory an entry at a time.
+// On POSIX the entry type comes from the directory itself (d_type), so
+// sub-directories cost no system calls at all and files cost a single
+// fstatat() relative to the open directory (for the size and
+// permissions). Symbolic links and file systems that do not report d_type
+// cost one more stat.
+class dir_reader
+{
+public:
+    // An unreadable directory reads as empty
+    explicit dir_reader(const std::string& path);
+    dir_reader(const dir_reader&) = delete;
+    dir_reader& operator=(const dir_reader&) = delete;
+    ~dir_reader();
+
+    // Skips "." and "..". Returns false at the end of the directory.
+    bool next(dir_entry& entry);
+
+private:
+#ifdef _WIN32
+    std::filesystem::directory_iterator _iter;
+#else
+    // path with a trailing separator
+    std::string _path;
+    DIR* _dir = nullptr;
+
+    void stat_at(const char* name, const int flags, file_info& info) const;
+#endif
+};